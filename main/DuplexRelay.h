@@ -0,0 +1,151 @@
+#ifndef DUPLEX_RELAY_H
+#define DUPLEX_RELAY_H
+
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "RadioLink.h"
+
+// Full-duplex relay on two SX1262 radios. `up` only transmits what arrives
+// on the UART, on its own frequency. `down` stays in RX on the other
+// frequency and writes every frame it hears to the UART. The peer relay uses
+// the same two frequencies swapped. Each direction runs in its own task on
+// the radio core, so a long TX no longer blinds the receiver.
+//
+// The radios share the SPI host with one device handle each (one EspHal per
+// radio). The bus is only held for a single command, see
+// EspHal::spiBeginTransaction.
+
+#define DUPLEX_FRAME_MAX 255
+#define DUPLEX_GAP_CHARS 4       // serial silence that ends a frame, >= 3.5 characters
+#define DUPLEX_CHAR_BITS 11      // start, 8 data, parity or second stop, stop
+#define DUPLEX_TX_TIMEOUT_MS 5000 // longer than the airtime of a full SF12 frame
+#define DUPLEX_UART_BUFFER 1024
+#define DUPLEX_STACK 4096
+#define DUPLEX_PRIORITY 5
+
+class DuplexRelay
+{
+public:
+  DuplexRelay(EspHal *hal, RadioLink &up, RadioLink &down, uart_port_t uart)
+      : hal(hal), up(up), down(down), uart(uart)
+  {
+  }
+
+  // Radios must have been started with begin() on their own frequencies
+  esp_err_t begin(uint32_t baud, int txPin, int rxPin)
+  {
+    uart_config_t conf = {};
+    conf.baud_rate = (int)baud;
+    conf.data_bits = UART_DATA_8_BITS;
+    conf.parity = UART_PARITY_DISABLE;
+    conf.stop_bits = UART_STOP_BITS_1;
+    conf.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    conf.source_clk = UART_SCLK_DEFAULT;
+
+    esp_err_t ret = uart_driver_install(uart, DUPLEX_UART_BUFFER, DUPLEX_UART_BUFFER, 0, NULL, 0);
+    if (ret == ESP_OK)
+      ret = uart_param_config(uart, &conf);
+    if (ret == ESP_OK)
+      ret = uart_set_pin(uart, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    // Hand the FIFO to the driver after the gap instead of the default 10
+    // characters, so the tail of a frame is not held back
+    if (ret == ESP_OK)
+      ret = uart_set_rx_timeout(uart, DUPLEX_GAP_CHARS);
+    if (ret != ESP_OK)
+    {
+      ESP_LOGE("duplex", "UART init failed: %s", esp_err_to_name(ret));
+      return (ret);
+    }
+
+    // The gap is a few ms at most, well below a tick (10 ms at 100 Hz), so
+    // round up and add one: the first tick of a wait can be cut short
+    uint32_t gapUs = (uint32_t)((uint64_t)DUPLEX_GAP_CHARS * DUPLEX_CHAR_BITS * 1000000 / baud);
+    gapTicks = pdMS_TO_TICKS((gapUs + 999) / 1000) + 1;
+
+    down.onReceived(onDownReceived, this);
+    hal->startTask(upLoop, "duplex_up", DUPLEX_STACK, this, DUPLEX_PRIORITY);
+    hal->startTask(downLoop, "duplex_down", DUPLEX_STACK, this, DUPLEX_PRIORITY);
+    return (ESP_OK);
+  }
+
+  uint32_t txFrames = 0;
+  uint32_t txFailed = 0;
+  uint32_t rxFrames = 0;
+
+private:
+  EspHal *hal;
+  RadioLink &up;
+  RadioLink &down;
+  uart_port_t uart;
+  TickType_t gapTicks = 2;
+  uint8_t rxFrame[DUPLEX_FRAME_MAX];
+
+  // One frame: block for the first byte, then read until the line is quiet
+  size_t readFrame(uint8_t *frame)
+  {
+    int n = uart_read_bytes(uart, frame, 1, portMAX_DELAY);
+    size_t len = n > 0 ? n : 0;
+    while (len > 0 && len < DUPLEX_FRAME_MAX)
+    {
+      n = uart_read_bytes(uart, frame + len, DUPLEX_FRAME_MAX - len, gapTicks);
+      if (n <= 0)
+        break;
+      len += n;
+    }
+    return (len);
+  }
+
+  static void upLoop(void *arg)
+  {
+    DuplexRelay *relay = (DuplexRelay *)arg;
+    uint8_t frame[DUPLEX_FRAME_MAX];
+    relay->up.setTask(xTaskGetCurrentTaskHandle());
+    for (;;)
+    {
+      size_t len = relay->readFrame(frame);
+      if (len == 0)
+        continue;
+      // Drop a DIO1 edge that came in after the last timeout's standby()
+      ulTaskNotifyTake(pdTRUE, 0);
+      if (relay->up.startTransmit(frame, len) != RADIOLIB_ERR_NONE ||
+          ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DUPLEX_TX_TIMEOUT_MS)) == 0)
+      {
+        // No TxDone: stop the radio, or the next frame would be taken for
+        // its completion
+        relay->up.standby();
+        relay->txFailed++;
+        continue;
+      }
+      relay->txFrames++;
+      relay->up.service();
+    }
+  }
+
+  static void downLoop(void *arg)
+  {
+    DuplexRelay *relay = (DuplexRelay *)arg;
+    relay->down.setTask(xTaskGetCurrentTaskHandle());
+    relay->down.startReceive();
+    for (;;)
+    {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      relay->down.service();
+    }
+  }
+
+  static void onDownReceived(RadioLink &link, void *ctx)
+  {
+    DuplexRelay *relay = (DuplexRelay *)ctx;
+    size_t len = link.packetLength();
+    if (len > DUPLEX_FRAME_MAX)
+      len = DUPLEX_FRAME_MAX;
+    if (link.phy().readData(relay->rxFrame, len) == RADIOLIB_ERR_NONE)
+    {
+      uart_write_bytes(relay->uart, relay->rxFrame, len);
+      relay->rxFrames++;
+    }
+    link.startReceive();
+  }
+};
+
+#endif
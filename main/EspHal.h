@@ -4,26 +4,25 @@
 // include RadioLib
 #include <RadioLib.h>
 
-// this example only works on ESP32 and is unlikely to work on ESP32S2/S3 etc.
-// if you need high portability, you should probably use Arduino anyway ...
-#if CONFIG_IDF_TARGET_ESP32C3 == 0
-#error This example HAL only supports ESP32C3 targets. Support for ESP32S2/S3 etc. can be added by adjusting this file to user needs.
-#endif
+// One HAL for the ESP32 and ESP32-C3, specialised at compile time on a
+// target traits struct. Both targets drive the SX1262 through the spi_master
+// driver; what differs is in the traits.
 
 // include all the dependencies
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-// #include "esp32/rom/gpio.h"
 #include "soc/rtc.h"
-// #include "soc/dport_reg.h"
-#include "soc/spi_reg.h"
-#include "soc/spi_struct.h"
 #include "driver/gpio.h"
+#include "driver/spi_master.h"
 #include "hal/gpio_hal.h"
+#include "hal/gpio_ll.h"
+#include "esp_cpu.h"
+#include "esp_attr.h"
 #include "esp_timer.h"
 #include "esp_log.h"
-
-#include "esp_private/periph_ctrl.h"
+#if !CONFIG_FREERTOS_UNICORE
+#include "esp_ipc.h"
+#endif
 
 // define Arduino-style macros
 #define LOW (0x0)
@@ -34,116 +33,39 @@
 #define FALLING (0x02)
 #define NOP() asm volatile("nop")
 
-#define MATRIX_DETACH_OUT_SIG (0x100)
-#define MATRIX_DETACH_IN_LOW_PIN (0x30)
+#define ESP_HAL_SPI_HZ (1 * 1000 * 1000)
 
-// all of the following is needed to calculate SPI clock divider
-#define ClkRegToFreq(reg) (apb_freq / (((reg)->clkdiv_pre + 1) * ((reg)->clkcnt_n + 1)))
-
-typedef union
+struct Esp32Target
 {
-  uint32_t value;
-  struct
-  {
-    uint32_t clkcnt_l : 6;
-    uint32_t clkcnt_h : 6;
-    uint32_t clkcnt_n : 6;
-    uint32_t clkdiv_pre : 13;
-    uint32_t clk_equ_sysclk : 1;
-  };
-} spiClk_t;
-
-uint32_t getApbFrequency()
-{
-  rtc_cpu_freq_config_t conf;
-  rtc_clk_cpu_freq_get_config(&conf);
-
-  if (conf.freq_mhz >= 80)
-  {
-    return (80 * MHZ);
-  }
-
-  return ((conf.source_freq_mhz * MHZ) / conf.div);
-}
+  static constexpr spi_host_device_t spiHost = SPI2_HOST; // HSPI
+  static constexpr spi_dma_chan_t dmaChannel = SPI_DMA_CH_AUTO;
+  static constexpr bool dualCore = true;
+};
 
-uint32_t spiFrequencyToClockDiv(uint32_t freq)
+struct Esp32c3Target
 {
-  uint32_t apb_freq = getApbFrequency();
-  if (freq >= apb_freq)
-  {
-    return SPI_CLK_EQU_SYSCLK;
-  }
-
-  const spiClk_t minFreqReg = {0x7FFFF000};
-  uint32_t minFreq = ClkRegToFreq((spiClk_t *)&minFreqReg);
-  if (freq < minFreq)
-  {
-    return minFreqReg.value;
-  }
-
-  uint8_t calN = 1;
-  spiClk_t bestReg = {0};
-  int32_t bestFreq = 0;
-  while (calN <= 0x3F)
-  {
-    spiClk_t reg = {0};
-    int32_t calFreq;
-    int32_t calPre;
-    int8_t calPreVari = -2;
-
-    reg.clkcnt_n = calN;
-
-    while (calPreVari++ <= 1)
-    {
-      calPre = (((apb_freq / (reg.clkcnt_n + 1)) / freq) - 1) + calPreVari;
-      if (calPre > 0x1FFF)
-      {
-        reg.clkdiv_pre = 0x1FFF;
-      }
-      else if (calPre <= 0)
-      {
-        reg.clkdiv_pre = 0;
-      }
-      else
-      {
-        reg.clkdiv_pre = calPre;
-      }
-      reg.clkcnt_l = ((reg.clkcnt_n + 1) / 2);
-      calFreq = ClkRegToFreq(&reg);
-      if (calFreq == (int32_t)freq)
-      {
-        memcpy(&bestReg, &reg, sizeof(bestReg));
-        break;
-      }
-      else if (calFreq < (int32_t)freq)
-      {
-        if (RADIOLIB_ABS(freq - calFreq) < RADIOLIB_ABS(freq - bestFreq))
-        {
-          bestFreq = calFreq;
-          memcpy(&bestReg, &reg, sizeof(bestReg));
-        }
-      }
-    }
-    if (calFreq == (int32_t)freq)
-    {
-      break;
-    }
-    calN++;
-  }
-  return (bestReg.value);
-}
+  static constexpr spi_host_device_t spiHost = SPI2_HOST; // the only general purpose SPI
+  static constexpr spi_dma_chan_t dmaChannel = SPI_DMA_CH_AUTO;
+  static constexpr bool dualCore = false;
+};
 
 // create a new ESP-IDF hardware abstraction layer
 // the HAL must inherit from the base RadioLibHal class
 // and implement all of its virtual methods
 // this is pretty much just copied from Arduino ESP32 core
-class EspHal : public RadioLibHal
+//
+// On dual-core targets `core` pins the DIO1 interrupt, the SPI interrupt and
+// tasks started with startTask() to one core, so UART handling on the other
+// core cannot delay them. -1 (and any value on single-core targets) leaves
+// them unpinned.
+template <typename Target>
+class EspHalT : public RadioLibHal
 {
 public:
   // default constructor - initializes the base HAL and any needed private members
-  EspHal(int8_t sck, int8_t miso, int8_t mosi)
+  EspHalT(int8_t sck, int8_t miso, int8_t mosi, int8_t core = -1)
       : RadioLibHal(INPUT, OUTPUT, LOW, HIGH, RISING, FALLING),
-        spiSCK(sck), spiMISO(miso), spiMOSI(mosi)
+        spiSCK(sck), spiMISO(miso), spiMOSI(mosi), radioCore(Target::dualCore ? core : -1)
   {
   }
 
@@ -153,6 +75,10 @@ public:
     if (!initialized)
       spiBegin();
     initialized = true;
+
+    rtc_cpu_freq_config_t conf;
+    rtc_clk_cpu_freq_get_config(&conf);
+    cpuMhz = conf.freq_mhz;
   }
 
   void term() override
@@ -192,39 +118,54 @@ public:
     gpio_set_pull_mode((gpio_num_t)pin, GPIO_PULLUP_ONLY);
   }
 
-  void digitalWrite(uint32_t pin, uint32_t value) override
+  // CS and BUSY are touched on every SPI access: write W1TS/W1TC and read
+  // the input register directly. IRAM saves the cache miss on these short
+  // calls; RadioLib calls them from flash, so a radio access still waits for
+  // an NVS write like any other flash code
+  IRAM_ATTR void digitalWrite(uint32_t pin, uint32_t value) override
   {
     if (pin == RADIOLIB_NC)
     {
       return;
     }
 
-    gpio_set_level((gpio_num_t)pin, value);
+    gpio_ll_set_level(GPIO_LL_GET_HW(GPIO_PORT_0), pin, value);
   }
 
-  uint32_t digitalRead(uint32_t pin) override
+  IRAM_ATTR uint32_t digitalRead(uint32_t pin) override
   {
     if (pin == RADIOLIB_NC)
     {
       return (0);
     }
 
-    return (gpio_get_level((gpio_num_t)pin));
+    return (gpio_ll_get_level(GPIO_LL_GET_HW(GPIO_PORT_0), pin));
   }
 
+  // RadioLib's context-free callbacks go through a trampoline that gets the
+  // callback as its argument
   void attachInterrupt(uint32_t interruptNum, void (*interruptCb)(void), uint32_t mode) override
+  {
+    attachInterruptArg(interruptNum, callVoid, (void *)interruptCb, mode);
+  }
+
+  // cb gets ctx on every edge, so each radio can have its own handler state
+  void attachInterruptArg(uint32_t interruptNum, void (*cb)(void *), void *ctx, uint32_t mode)
   {
     if (interruptNum == RADIOLIB_NC)
     {
       return;
     }
 
-    gpio_install_isr_service((int)ESP_INTR_FLAG_IRAM);
+    // The ISR service allocates its interrupt on the calling core
+#if !CONFIG_FREERTOS_UNICORE
+    if (radioCore >= 0 && radioCore != xPortGetCoreID())
+      esp_ipc_call_blocking(radioCore, installIsrService, NULL);
+    else
+#endif
+      installIsrService(NULL);
     gpio_set_intr_type((gpio_num_t)interruptNum, (gpio_int_type_t)(mode & 0x7));
-
-    // this uses function typecasting, which is not defined when the functions have different signatures
-    // untested and might not work
-    gpio_isr_handler_add((gpio_num_t)interruptNum, (void (*)(void *))interruptCb, NULL);
+    gpio_isr_handler_add((gpio_num_t)interruptNum, cb, ctx);
   }
 
   void detachInterrupt(uint32_t interruptNum) override
@@ -244,23 +185,20 @@ public:
     vTaskDelay(ms / portTICK_PERIOD_MS);
   }
 
-  void delayMicroseconds(unsigned long us) override
+  // Spins on the CPU cycle counter, which wraps after 2^32 cycles
+  // (26 s at 160 MHz); longer waits go through delay()
+  IRAM_ATTR void delayMicroseconds(unsigned long us) override
   {
-    uint64_t m = (uint64_t)esp_timer_get_time();
-    if (us)
+    if (us >= 1000000UL)
     {
-      uint64_t e = (m + us);
-      if (m > e)
-      { // overflow
-        while ((uint64_t)esp_timer_get_time() > e)
-        {
-          NOP();
-        }
-      }
-      while ((uint64_t)esp_timer_get_time() < e)
-      {
-        NOP();
-      }
+      delay(us / 1000);
+      return;
+    }
+    uint32_t start = esp_cpu_get_cycle_count();
+    uint32_t cycles = us * cpuMhz;
+    while (esp_cpu_get_cycle_count() - start < cycles)
+    {
+      NOP();
     }
   }
 
@@ -313,7 +251,7 @@ public:
         .max_transfer_sz = 256, // or whatever your maximum packet size is
         .flags = SPICOMMON_BUSFLAG_MASTER | SPICOMMON_BUSFLAG_GPIO_PINS |
                  SPICOMMON_BUSFLAG_MISO | SPICOMMON_BUSFLAG_MOSI | SPICOMMON_BUSFLAG_SCLK,
-        .isr_cpu_id = ESP_INTR_CPU_AFFINITY_AUTO,
+        .isr_cpu_id = radioCore < 0 ? ESP_INTR_CPU_AFFINITY_AUTO : (esp_intr_cpu_affinity_t)(ESP_INTR_CPU_AFFINITY_0 + radioCore),
         .intr_flags = 0};
 
     spi_device_interface_config_t devcfg = {
@@ -325,7 +263,7 @@ public:
         .duty_cycle_pos = 128,
         .cs_ena_pretrans = 0,
         .cs_ena_posttrans = 0,
-        .clock_speed_hz = 1 * 1000 * 1000, // 1 MHz
+        .clock_speed_hz = ESP_HAL_SPI_HZ,
         .input_delay_ns = 0,
         .spics_io_num = -1, // Manual CS
         .flags = 0,
@@ -334,15 +272,18 @@ public:
         .post_cb = NULL,
     };
 
-    esp_err_t ret = spi_bus_initialize(SPI2_HOST, &buscfg, SPI_DMA_CH_AUTO);
+    // Every radio on the host has its own EspHal and device handle, the
+    // first one brings up the bus
+    esp_err_t ret = busUsers ? ESP_OK : spi_bus_initialize(Target::spiHost, &buscfg, Target::dmaChannel);
     if (ret != ESP_OK)
     {
       ESP_LOGE("HAL", "[SPI] Bus init failed: %s", esp_err_to_name(ret));
       return;
     }
+    busUsers++;
 
     // Attach device to SPI bus
-    ret = spi_bus_add_device(SPI2_HOST, &devcfg, &spi);
+    ret = spi_bus_add_device(Target::spiHost, &devcfg, &spi);
     if (ret != ESP_OK || spi == NULL)
     {
       ESP_LOGE("HAL", "[SPI] Device add failed: %s", esp_err_to_name(ret));
@@ -351,12 +292,16 @@ public:
     ESP_LOGI("HAL", "[SPI] Init success");
   }
 
+  // CS is driven by hand, so hold the bus from CS low to CS high to keep
+  // another radio's command out. RadioLib waits for BUSY before and after
+  // this window, so the bus is never held while a radio is busy.
   void spiBeginTransaction()
   {
-    // not needed - in ESP32 Arduino core, this function
-    // repeats clock div, mode and bit order configuration
+    spi_device_acquire_bus(spi, portMAX_DELAY);
   }
 
+  // Polling transmit: radio commands are a few bytes, waiting for the
+  // transfer done interrupt and a semaphore costs more than the transfer
   uint8_t spiTransferByte(uint8_t b)
   {
     uint8_t rx;
@@ -364,7 +309,7 @@ public:
     t.length = 8;
     t.tx_buffer = &b;
     t.rx_buffer = &rx;
-    esp_err_t ret = spi_device_transmit(spi, &t);
+    esp_err_t ret = spi_device_polling_transmit(spi, &t);
     if (ret != ESP_OK)
     {
       ESP_LOGE("HAL", "[SPI] Transfer failed: %s", esp_err_to_name(ret));
@@ -373,29 +318,50 @@ public:
     return rx;
   }
 
+  // For HalBench, which times the driver paths on the same device
+  spi_device_handle_t spiDevice()
+  {
+    return (spi);
+  }
+
   void spiTransfer(uint8_t *out, size_t len, uint8_t *in)
   {
     spi_transaction_t t = {};
     t.length = len * 8;
     t.tx_buffer = out;
     t.rx_buffer = in;
-    esp_err_t ret = spi_device_transmit(spi, &t);
+    esp_err_t ret = spi_device_polling_transmit(spi, &t);
     if (ret != ESP_OK)
     {
       ESP_LOGE("HAL", "[SPI] Multi-byte transfer failed: %s", esp_err_to_name(ret));
     }
-    ESP_LOGI("HAL", "[SPI] Transfered %d bytes", len);
+    ESP_LOGV("HAL", "[SPI] Transfered %d bytes", len);
   }
 
   void spiEndTransaction()
   {
-    // nothing needs to be done here
+    spi_device_release_bus(spi);
   }
 
   void spiEnd()
   {
     spi_bus_remove_device(spi);
-    spi_bus_free(SPI2_HOST);
+    if (--busUsers == 0)
+      spi_bus_free(Target::spiHost);
+  }
+
+  // Called while waiting for BUSY, lets the other radio's task run
+  void yield() override
+  {
+    taskYIELD();
+  }
+
+  // Radio worker task, on the radio core when there is one
+  TaskHandle_t startTask(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t priority)
+  {
+    TaskHandle_t handle = NULL;
+    xTaskCreatePinnedToCore(fn, name, stack, arg, priority, &handle, radioCore < 0 ? tskNO_AFFINITY : radioCore);
+    return handle;
   }
 
 private:
@@ -405,7 +371,28 @@ private:
   int8_t spiMOSI;
   int8_t spiCS;
   uint8_t initialized = false;
+  uint32_t cpuMhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
   spi_device_handle_t spi = NULL;
+  int8_t radioCore;
+  static inline uint8_t busUsers = 0;
+
+  static void installIsrService(void *)
+  {
+    gpio_install_isr_service((int)ESP_INTR_FLAG_IRAM);
+  }
+
+  static IRAM_ATTR void callVoid(void *cb)
+  {
+    ((void (*)(void))cb)();
+  }
 };
 
+#if CONFIG_IDF_TARGET_ESP32
+typedef EspHalT<Esp32Target> EspHal;
+#elif CONFIG_IDF_TARGET_ESP32C3
+typedef EspHalT<Esp32c3Target> EspHal;
+#else
+#error EspHal only supports ESP32 and ESP32C3 targets. Other targets need their own traits struct.
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,96 @@
+#ifndef HAL_BENCH_H
+#define HAL_BENCH_H
+
+#include "driver/gpio.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "driver/spi_master.h"
+
+// Cost of the HAL hot path, in CPU cycles per operation. Each test runs
+// HAL_BENCH_ROUNDS times with interrupts enabled, so take the mean as an
+// upper bound. The "before" rows repeat what EspHal did before the fast
+// path: gpio_set_level for CS, spi_device_transmit (interrupt and queue) and
+// an ESP_LOGI per transfer. The logging row prints every round to the
+// console, so it runs only HAL_BENCH_LOG_ROUNDS times.
+#define HAL_BENCH_ROUNDS 1000
+#define HAL_BENCH_LOG_ROUNDS 20
+
+static const char *BENCH_TAG = "bench";
+
+static void halBenchReport(const char *name, uint32_t cycles, uint32_t mhz, uint32_t rounds = HAL_BENCH_ROUNDS)
+{
+    uint32_t mean = cycles / rounds;
+    ESP_LOGI(BENCH_TAG, "%-24s %6lu cycles %7lu ns", name, (unsigned long)mean, (unsigned long)(mean * 1000 / mhz));
+}
+
+// cs must already be an output; it is left high
+void halBenchmark(EspHal *hal, uint32_t cs)
+{
+    rtc_cpu_freq_config_t conf;
+    rtc_clk_cpu_freq_get_config(&conf);
+    uint32_t mhz = conf.freq_mhz;
+
+    // GetStatus plus padding, harmless on a live radio
+    uint8_t out[4] = {0xC0, 0x00, 0x00, 0x00};
+    uint8_t in[4];
+    uint32_t start;
+
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < HAL_BENCH_ROUNDS; i++)
+    {
+        gpio_set_level((gpio_num_t)cs, 0);
+        gpio_set_level((gpio_num_t)cs, 1);
+    }
+    halBenchReport("CS toggle (before)", esp_cpu_get_cycle_count() - start, mhz);
+
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < HAL_BENCH_ROUNDS; i++)
+    {
+        hal->digitalWrite(cs, LOW);
+        hal->digitalWrite(cs, HIGH);
+    }
+    halBenchReport("CS toggle (hal)", esp_cpu_get_cycle_count() - start, mhz);
+
+    spi_transaction_t t = {};
+    t.length = sizeof(out) * 8;
+    t.tx_buffer = out;
+    t.rx_buffer = in;
+
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < HAL_BENCH_ROUNDS; i++)
+    {
+        gpio_set_level((gpio_num_t)cs, 0);
+        spi_device_transmit(hal->spiDevice(), &t);
+        gpio_set_level((gpio_num_t)cs, 1);
+    }
+    halBenchReport("CS + 4 bytes (before)", esp_cpu_get_cycle_count() - start, mhz);
+
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < HAL_BENCH_LOG_ROUNDS; i++)
+    {
+        gpio_set_level((gpio_num_t)cs, 0);
+        spi_device_transmit(hal->spiDevice(), &t);
+        ESP_LOGI("HAL", "[SPI] Transfered %d bytes", sizeof(out));
+        gpio_set_level((gpio_num_t)cs, 1);
+    }
+    halBenchReport("CS + 4 bytes + log (before)", esp_cpu_get_cycle_count() - start, mhz, HAL_BENCH_LOG_ROUNDS);
+
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < HAL_BENCH_ROUNDS; i++)
+    {
+        hal->digitalWrite(cs, LOW);
+        hal->spiTransfer(out, sizeof(out), in);
+        hal->digitalWrite(cs, HIGH);
+    }
+    halBenchReport("CS + 4 bytes (hal)", esp_cpu_get_cycle_count() - start, mhz);
+
+    // Overshoot of a short busy wait, ideally 10 us worth of cycles
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < HAL_BENCH_ROUNDS; i++)
+    {
+        hal->delayMicroseconds(10);
+    }
+    halBenchReport("delayMicroseconds(10)", esp_cpu_get_cycle_count() - start, mhz);
+}
+
+#endif
@@ -0,0 +1,348 @@
+#ifndef RADIO_ASYNC_H
+#define RADIO_ASYNC_H
+
+#include <coroutine>
+#include <stdlib.h>
+#include "RadioLink.h"
+
+// Awaitable radio operations on C++20 coroutines.
+//
+//   RadioTask poll(AsyncRadio &radio)
+//   {
+//     if (co_await radio.asyncCad() == RADIOLIB_CHANNEL_FREE)
+//       co_await radio.asyncTransmit(req, sizeof(req));
+//     int len = co_await radio.asyncReceive(buf, sizeof(buf), 500);
+//   }
+//
+// A RadioScheduler runs all coroutines on the task that calls run(). Radios
+// wake that task from their DIO1 interrupt (RadioLink::setTask), and it
+// sleeps until the next interrupt or deadline, so nothing busy-waits. Each
+// radio runs one operation at a time; any number of radios and sleeping
+// coroutines interleave on one core. All state is in fixed tables, only the
+// coroutine frames come from the heap, once per spawn().
+
+#define ASYNC_MAX_RADIOS 4
+#define ASYNC_MAX_READY 16
+#define ASYNC_MAX_TIMERS 8
+#define ASYNC_TX_TIMEOUT_MS 5000 // longer than the airtime of a full SF12 frame
+
+// Fire-and-forget coroutine started with RadioScheduler::spawn()
+struct RadioTask
+{
+  struct promise_type
+  {
+    RadioTask get_return_object()
+    {
+      return (RadioTask{std::coroutine_handle<promise_type>::from_promise(*this)});
+    }
+    std::suspend_always initial_suspend()
+    {
+      return {};
+    }
+    // Stay suspended at the end so the scheduler can destroy the frame
+    std::suspend_always final_suspend() noexcept
+    {
+      return {};
+    }
+    void return_void()
+    {
+    }
+    void unhandled_exception()
+    {
+      abort();
+    }
+  };
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+class AsyncRadio;
+
+class RadioScheduler
+{
+public:
+  void spawn(RadioTask task)
+  {
+    ready(task.handle);
+  }
+
+  void attach(AsyncRadio *radio)
+  {
+    if (radioCount < ASYNC_MAX_RADIOS)
+      radios[radioCount++] = radio;
+  }
+
+  void ready(std::coroutine_handle<> h)
+  {
+    if (readyCount == ASYNC_MAX_READY)
+      abort();
+    readyQueue[(readyHead + readyCount++) % ASYNC_MAX_READY] = h;
+  }
+
+  uint32_t now()
+  {
+    return ((uint32_t)(esp_timer_get_time() / 1000ULL));
+  }
+
+  // co_await scheduler.sleep(ms)
+  struct Sleep
+  {
+    RadioScheduler &sched;
+    uint32_t ms;
+
+    bool await_ready()
+    {
+      return (ms == 0);
+    }
+    void await_suspend(std::coroutine_handle<> h)
+    {
+      sched.addTimer(h, sched.now() + ms);
+    }
+    void await_resume()
+    {
+    }
+  };
+
+  Sleep sleep(uint32_t ms)
+  {
+    return (Sleep{*this, ms});
+  }
+
+  // Never returns
+  void run();
+
+  void addTimer(std::coroutine_handle<> h, uint32_t at)
+  {
+    for (int i = 0; i < ASYNC_MAX_TIMERS; i++)
+    {
+      if (!timers[i].handle)
+      {
+        timers[i].handle = h;
+        timers[i].at = at;
+        return;
+      }
+    }
+    abort();
+  }
+
+private:
+  struct Timer
+  {
+    std::coroutine_handle<> handle;
+    uint32_t at;
+  };
+
+  AsyncRadio *radios[ASYNC_MAX_RADIOS];
+  uint8_t radioCount = 0;
+  std::coroutine_handle<> readyQueue[ASYNC_MAX_READY];
+  uint8_t readyHead = 0;
+  uint8_t readyCount = 0;
+  Timer timers[ASYNC_MAX_TIMERS] = {};
+
+  TickType_t pollTimers(uint32_t t);
+};
+
+class AsyncRadio
+{
+public:
+  enum Op
+  {
+    OP_NONE,
+    OP_TX,
+    OP_RX,
+    OP_CAD,
+  };
+
+  AsyncRadio(RadioLink &link, RadioScheduler &sched)
+      : link(link), sched(sched)
+  {
+    sched.attach(this);
+  }
+
+  // Result is a RadioLib status code (RADIOLIB_ERR_*)
+  struct Operation
+  {
+    AsyncRadio &radio;
+    int16_t started;
+
+    bool await_ready()
+    {
+      return (started != RADIOLIB_ERR_NONE);
+    }
+    void await_suspend(std::coroutine_handle<> h)
+    {
+      radio.waiter = h;
+    }
+    int16_t await_resume()
+    {
+      return (started != RADIOLIB_ERR_NONE ? started : radio.result);
+    }
+  };
+
+  Operation asyncTransmit(const uint8_t *data, size_t len)
+  {
+    return (start(OP_TX, [&] { return (link.phy().startTransmit(data, len)); }, ASYNC_TX_TIMEOUT_MS));
+  }
+
+  // Frame length on success, a negative RadioLib status otherwise
+  // (RADIOLIB_ERR_RX_TIMEOUT once timeoutMs passed, 0 waits forever)
+  Operation asyncReceive(uint8_t *buf, size_t maxLen, uint32_t timeoutMs)
+  {
+    rxBuf = buf;
+    rxMax = maxLen;
+    return (start(OP_RX, [&] { return (link.phy().startReceive()); }, timeoutMs));
+  }
+
+  // RADIOLIB_CHANNEL_FREE or RADIOLIB_LORA_DETECTED
+  Operation asyncCad()
+  {
+    return (start(OP_CAD, [&] { return (link.phy().startChannelScan()); }, ASYNC_TX_TIMEOUT_MS));
+  }
+
+  // Resumes the waiting coroutine on DIO1 or its deadline, from run()
+  bool poll(uint32_t t)
+  {
+    if (op == OP_NONE)
+      return (false);
+    if (link.takeIrq())
+    {
+      result = complete();
+    }
+    else if (deadline && (int32_t)(t - deadline) >= 0)
+    {
+      link.phy().standby();
+      result = op == OP_RX ? RADIOLIB_ERR_RX_TIMEOUT : RADIOLIB_ERR_TX_TIMEOUT;
+    }
+    else
+    {
+      return (false);
+    }
+    op = OP_NONE;
+    // Started without co_await, nobody to resume
+    if (waiter)
+      sched.ready(waiter);
+    waiter = nullptr;
+    return (true);
+  }
+
+  // DIO1 wakes the scheduler task
+  void setTask(TaskHandle_t task)
+  {
+    link.setTask(task);
+  }
+
+  // Milliseconds until this radio's deadline, -1 for none
+  int32_t timeLeft(uint32_t t)
+  {
+    if (op == OP_NONE || !deadline)
+      return (-1);
+    int32_t left = (int32_t)(deadline - t);
+    return (left > 0 ? left : 0);
+  }
+
+private:
+  RadioLink &link;
+  RadioScheduler &sched;
+  std::coroutine_handle<> waiter;
+  Op op = OP_NONE;
+  uint32_t deadline = 0;
+  int16_t result = RADIOLIB_ERR_NONE;
+  uint8_t *rxBuf = NULL;
+  size_t rxMax = 0;
+
+  // Issues the radio command; a fast operation (CAD) can raise DIO1 before
+  // the command returns, so a stale edge is cleared first, not after
+  template <typename Command>
+  Operation start(Op which, Command command, uint32_t timeoutMs)
+  {
+    link.takeIrq();
+    int16_t state = command();
+    if (state == RADIOLIB_ERR_NONE)
+    {
+      op = which;
+      deadline = timeoutMs ? sched.now() + timeoutMs : 0;
+      // 0 is "no deadline"
+      if (timeoutMs && deadline == 0)
+        deadline = 1;
+    }
+    return (Operation{*this, state});
+  }
+
+  int16_t complete()
+  {
+    switch (op)
+    {
+    case OP_TX:
+      return (link.phy().finishTransmit());
+    case OP_CAD:
+      return (link.phy().getChannelScanResult());
+    case OP_RX:
+    {
+      size_t len = link.packetLength();
+      if (len > rxMax)
+        len = rxMax;
+      int16_t state = link.phy().readData(rxBuf, len);
+      return (state == RADIOLIB_ERR_NONE ? (int16_t)len : state);
+    }
+    default:
+      return (RADIOLIB_ERR_NONE);
+    }
+  }
+};
+
+inline TickType_t RadioScheduler::pollTimers(uint32_t t)
+{
+  int32_t wait = -1;
+  for (int i = 0; i < ASYNC_MAX_TIMERS; i++)
+  {
+    if (!timers[i].handle)
+      continue;
+    int32_t left = (int32_t)(timers[i].at - t);
+    if (left <= 0)
+    {
+      ready(timers[i].handle);
+      timers[i].handle = nullptr;
+    }
+    else if (wait < 0 || left < wait)
+    {
+      wait = left;
+    }
+  }
+  for (int i = 0; i < radioCount; i++)
+  {
+    int32_t left = radios[i]->timeLeft(t);
+    if (left >= 0 && (wait < 0 || left < wait))
+      wait = left;
+  }
+  return (wait < 0 ? portMAX_DELAY : pdMS_TO_TICKS(wait) + 1);
+}
+
+inline void RadioScheduler::run()
+{
+  for (int i = 0; i < radioCount; i++)
+    radios[i]->setTask(xTaskGetCurrentTaskHandle());
+  for (;;)
+  {
+    uint32_t t = now();
+    for (int i = 0; i < radioCount; i++)
+      radios[i]->poll(t);
+    TickType_t wait = pollTimers(t);
+
+    if (readyCount == 0)
+    {
+      ulTaskNotifyTake(pdTRUE, wait);
+      continue;
+    }
+    while (readyCount)
+    {
+      std::coroutine_handle<> h = readyQueue[readyHead];
+      readyHead = (readyHead + 1) % ASYNC_MAX_READY;
+      readyCount--;
+      h.resume();
+      if (h.done())
+        h.destroy();
+    }
+  }
+}
+
+#endif
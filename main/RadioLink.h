@@ -0,0 +1,147 @@
+#ifndef RADIO_LINK_H
+#define RADIO_LINK_H
+
+#include <RadioLib.h>
+#include "EspHal.h"
+
+// One SX1262 with its own DIO1 interrupt and state. RadioLib's
+// setPacketReceivedAction/setPacketSentAction take plain function pointers,
+// so they are not used: the DIO1 interrupt is attached through
+// EspHal::attachInterruptArg with the RadioLink as context, and events are
+// handed to callbacks that carry a user context. Several links can share an
+// MCU (and an SPI bus) without any globals.
+//
+// The ISR only flags the event and wakes the task set with setTask().
+// service() runs the callbacks from that task.
+class RadioLink
+{
+public:
+  typedef void (*EventCb)(RadioLink &link, void *ctx);
+
+  RadioLink(EspHal *hal, uint32_t nss, uint32_t dio1, uint32_t rst, uint32_t busy)
+      : hal(hal), dio1Pin(dio1), module(hal, nss, dio1, rst, busy), radio(&module)
+  {
+  }
+
+  int16_t begin(float freq, float bw, uint8_t sf, uint8_t cr, uint8_t syncWord, int8_t power, uint16_t preamble,
+                float tcxoVoltage)
+  {
+    int16_t state = radio.begin(freq, bw, sf, cr, syncWord, power, preamble, tcxoVoltage);
+    if (state == RADIOLIB_ERR_NONE)
+    {
+      hal->attachInterruptArg(dio1Pin, onDio1, this, RISING);
+    }
+    return (state);
+  }
+
+  void onReceived(EventCb cb, void *ctx)
+  {
+    receivedCb = cb;
+    receivedCtx = ctx;
+  }
+
+  void onSent(EventCb cb, void *ctx)
+  {
+    sentCb = cb;
+    sentCtx = ctx;
+  }
+
+  // Task woken by a DIO1 edge, NULL to poll service()
+  void setTask(TaskHandle_t task)
+  {
+    notifyTask = task;
+  }
+
+  int16_t startReceive()
+  {
+    txBusy = false;
+    return (radio.startReceive());
+  }
+
+  int16_t startTransmit(const uint8_t *data, size_t len)
+  {
+    txBusy = true;
+    return (radio.startTransmit(data, len));
+  }
+
+  // Aborts a TX or RX that will not complete; a late DIO1 edge is dropped
+  int16_t standby()
+  {
+    txBusy = false;
+    int16_t state = radio.standby();
+    irqPending = false;
+    return (state);
+  }
+
+  // Length of the frame that was received; read it with phy().readData()
+  size_t packetLength()
+  {
+    return (radio.getPacketLength());
+  }
+
+  // Consumes a DIO1 edge without running callbacks, for callers that track
+  // the operation themselves (RadioAsync)
+  bool takeIrq()
+  {
+    return (__atomic_exchange_n(&irqPending, false, __ATOMIC_ACQ_REL));
+  }
+
+  // Runs the callback for an event since the last call, true if there was one
+  bool service()
+  {
+    if (!irqPending)
+    {
+      return (false);
+    }
+    irqPending = false;
+
+    if (txBusy)
+    {
+      txBusy = false;
+      radio.finishTransmit();
+      if (sentCb)
+      {
+        sentCb(*this, sentCtx);
+      }
+    }
+    else if (receivedCb)
+    {
+      receivedCb(*this, receivedCtx);
+    }
+    return (true);
+  }
+
+  SX1262 &phy()
+  {
+    return (radio);
+  }
+
+private:
+  EspHal *hal;
+  uint32_t dio1Pin;
+  Module module;
+  SX1262 radio;
+
+  volatile bool irqPending = false;
+  bool txBusy = false;
+  TaskHandle_t notifyTask = NULL;
+
+  EventCb receivedCb = NULL;
+  void *receivedCtx = NULL;
+  EventCb sentCb = NULL;
+  void *sentCtx = NULL;
+
+  static IRAM_ATTR void onDio1(void *arg)
+  {
+    RadioLink *link = (RadioLink *)arg;
+    link->irqPending = true;
+    if (link->notifyTask)
+    {
+      BaseType_t woken = pdFALSE;
+      vTaskNotifyGiveFromISR(link->notifyTask, &woken);
+      portYIELD_FROM_ISR(woken);
+    }
+  }
+};
+
+#endif
@@ -1,11 +1,16 @@
 #include <stdio.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/spi_master.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
 #include <RadioLib.h>
-#include "Esp32c3Hal.h"
+#include "EspHal.h"
+#include "HalBench.h"
+#include "RadioLink.h"
+#include "DuplexRelay.h"
+#include "RadioAsync.h"
 
 #define BYTE_TO_BINARY_PATTERN "%c%c%c%c%c%c%c%c"
 #define BYTE_TO_BINARY(byte)         \
@@ -26,7 +31,26 @@
 #define SX_PIN_CLK 10
 #define SX_PIN_NSS 8
 
+// Print the HAL hot path cost at boot
+#define HAL_BENCHMARK 0
+
+// Full-duplex relay with a second SX1262 on the same SPI bus. The first
+// radio transmits on sx_freq, the second receives on sx_freq_down. Both
+// share the reset line, which the first radio drives.
+#define SX_DUPLEX 0
+#define SX2_PIN_NSS 2
+#define SX2_PIN_BUSY 1
+#define SX2_PIN_DIO1 0
+#define DUPLEX_UART UART_NUM_1
+#define DUPLEX_PIN_TX 19
+#define DUPLEX_PIN_RX 18
+#define DUPLEX_BAUD 9600
+
+// Run the demo as a coroutine on the async radio layer
+#define SX_ASYNC 0
+
 constexpr float sx_freq = 868.0f;
+constexpr float sx_freq_down = 869.5f;
 constexpr float sx_bw = 125.0f;
 constexpr uint8_t sx_sf = 9U;
 constexpr uint8_t sx_cr = 7U;
@@ -42,8 +66,14 @@ EspHal *hal = new EspHal(SX_PIN_CLK, SX_PIN_MISO, SX_PIN_MOSI);
 // BUSY gpio:  4
 // NRST gpio:  5
 // DIO1 gpio:  3
-Module* module = new Module(hal, SX_PIN_NSS, SX_PIN_DIO1, SX_PIN_RST, SX_PIN_BUSY);
-SX1262 radio(module);
+RadioLink radioLink(hal, SX_PIN_NSS, SX_PIN_DIO1, SX_PIN_RST, SX_PIN_BUSY);
+
+#if SX_DUPLEX
+// Own HAL for its own SPI device handle on the shared bus
+EspHal *hal2 = new EspHal(SX_PIN_CLK, SX_PIN_MISO, SX_PIN_MOSI);
+RadioLink radioLink2(hal2, SX2_PIN_NSS, SX2_PIN_DIO1, RADIOLIB_NC, SX2_PIN_BUSY);
+DuplexRelay duplex(hal, radioLink, radioLink2, DUPLEX_UART);
+#endif
 
 
 void readRegisters(uint16_t regAddress, uint8_t *buffer, uint8_t length)
@@ -103,6 +133,33 @@ void sendCommand(uint8_t opcode, uint8_t *buffer, uint8_t length)
 
 static const char *TAG = "main";
 
+static void onSent(RadioLink &radio, void *ctx)
+{
+    // the packet was successfully transmitted
+    ESP_LOGI((const char *)ctx, "success!");
+}
+
+#if SX_ASYNC
+RadioScheduler scheduler;
+AsyncRadio asyncRadio(radioLink, scheduler);
+
+// Send when the channel is free, then listen a second for an answer
+static RadioTask pingLoop(AsyncRadio &radio, RadioScheduler &sched)
+{
+    uint8_t reply[64];
+    for (;;)
+    {
+        if (co_await radio.asyncCad() == RADIOLIB_CHANNEL_FREE &&
+            co_await radio.asyncTransmit((const uint8_t *)"Hello World!", strlen("Hello World!")) == RADIOLIB_ERR_NONE)
+        {
+            int len = co_await radio.asyncReceive(reply, sizeof(reply), 1000);
+            ESP_LOGI(TAG, "reply: %d", len);
+        }
+        co_await sched.sleep(1000);
+    }
+}
+#endif
+
 extern "C" void app_main(void)
 {
     gpio_config_t io_conf = {
@@ -112,6 +169,11 @@ extern "C" void app_main(void)
         .pull_down_en = GPIO_PULLDOWN_DISABLE,
         .intr_type = GPIO_INTR_DISABLE};
     gpio_config(&io_conf);
+#if SX_DUPLEX
+    // Keep the second radio off the bus until it is set up
+    gpio_set_direction((gpio_num_t)SX2_PIN_NSS, GPIO_MODE_OUTPUT);
+    gpio_set_level((gpio_num_t)SX2_PIN_NSS, 1);
+#endif
 
     gpio_set_level((gpio_num_t)SX_PIN_RST, 0);
     vTaskDelay(pdMS_TO_TICKS(10));
@@ -121,6 +183,9 @@ extern "C" void app_main(void)
     vTaskDelay(pdMS_TO_TICKS(10));
 
     hal->init();
+#if HAL_BENCHMARK
+    halBenchmark(hal, SX_PIN_NSS);
+#endif
     uint8_t in[2] = {0};
     // Read from Node Address register (0x06CD)
     uint8_t random[4] = {1, 1, 1, 1};
@@ -135,14 +200,14 @@ extern "C" void app_main(void)
     // initialize just like with Arduino
     ESP_LOGI(TAG, "[SX1276] Initializing ... ");
 
-    int state = radio.begin(sx_freq,
-                            sx_bw,
-                            sx_sf,
-                            sx_cr,
-                            sx_sync,
-                            sx_power,
-                            sx_preamble,
-                            sx_gain);
+    int state = radioLink.begin(sx_freq,
+                           sx_bw,
+                           sx_sf,
+                           sx_cr,
+                           sx_sync,
+                           sx_power,
+                           sx_preamble,
+                           sx_gain);
 
     if (state != RADIOLIB_ERR_NONE)
     {
@@ -154,21 +219,52 @@ extern "C" void app_main(void)
     }
     ESP_LOGI(TAG, "success!\n");
 
+#if SX_DUPLEX
+    state = radioLink2.begin(sx_freq_down,
+                        sx_bw,
+                        sx_sf,
+                        sx_cr,
+                        sx_sync,
+                        sx_power,
+                        sx_preamble,
+                        sx_gain);
+    if (state != RADIOLIB_ERR_NONE)
+    {
+        ESP_LOGI(TAG, "second radio failed, code %d\n", state);
+        return;
+    }
+    if (duplex.begin(DUPLEX_BAUD, DUPLEX_PIN_TX, DUPLEX_PIN_RX) != ESP_OK)
+    {
+        ESP_LOGI(TAG, "duplex relay failed\n");
+        while (true)
+        {
+            hal->delay(1000);
+        }
+    }
+    return;
+#endif
+#if SX_ASYNC
+    scheduler.spawn(pingLoop(asyncRadio, scheduler));
+    scheduler.run();
+#endif
+    radioLink.onSent(onSent, (void *)TAG);
+    radioLink.setTask(xTaskGetCurrentTaskHandle());
+
     // loop forever
     for (;;)
     {
         // send a packet
         ESP_LOGI(TAG, "[SX1276] Transmitting packet ... ");
-        state = radio.transmit("Hello World!");
-        if (state == RADIOLIB_ERR_NONE)
+        state = radioLink.startTransmit((const uint8_t *)"Hello World!", strlen("Hello World!"));
+        if (state != RADIOLIB_ERR_NONE)
         {
-            // the packet was successfully transmitted
-            ESP_LOGI(TAG, "success!");
+            ESP_LOGI(TAG, "failed, code %d\n", state);
         }
-        else
+        else if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(2000)) == 0)
         {
-            ESP_LOGI(TAG, "failed, code %d\n", state);
+            ESP_LOGI(TAG, "failed, no TX done");
         }
+        radioLink.service();
 
         // wait for a second before transmitting again
         hal->delay(1000);
@@ -0,0 +1,219 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "LoRaWan_APP.h"
+#include "driver/sx126x.h"
+#include "settings.h"
+
+/*
+ * Channel occupancy scan
+ *
+ * Steps the receiver across SCAN_FREQ_MIN..SCAN_FREQ_MAX and samples the
+ * instantaneous RSSI for `dwell` ms on every channel. Samples go into a
+ * fixed histogram of 10 dB bins per channel (bin 0 below -120 dBm, the last
+ * one -60 dBm and up). A sample at or above the LBT threshold counts as busy.
+ * The recommended channel has the lowest busy share, ties go to the lower
+ * mean RSSI.
+ *
+ * AT+CHANNEL and AT+MODEM move a link to a new frequency or modem (LoRa or
+ * GFSK): the relay sends a channel control frame carrying both
+ * SCAN_ANNOUNCE_REPEATS times (LBT or TDMA slot), then switches itself.
+ * Relays receiving it switch once their radio is idle. After a switch both
+ * sides send a probe every SCAN_PROBE_MS on the new channel until they hear
+ * a peer there, and answer unconfirmed probes. A relay that hears nobody
+ * within SCAN_CONFIRM_MS returns to the old frequency and modem, so a missed
+ * announcement or a mismatched GFSK profile does not split the link. The
+ * change is not stored until AT+SAVE.
+ */
+
+#define SCAN_BINS 8
+#define SCAN_BIN_BASE -120
+#define SCAN_BIN_WIDTH 10
+
+typedef struct
+{
+    uint32_t freq;
+    uint16_t samples;
+    uint16_t busy;
+    int16_t maxRssi;
+    int32_t sumRssi;
+    uint16_t bins[SCAN_BINS];
+} scan_channel_t;
+
+static scan_channel_t scanChannels[SCAN_MAX_CHANNELS];
+static uint8_t scanCount = 0;
+static uint32_t scanAnnounceFreq = 0; // channel we are announcing
+static bool scanAnnounceFsk = false;
+static uint8_t scanAnnounceLeft = 0;
+static uint32_t scanPendingFreq = 0; // switch to this once idle
+static bool scanPendingFsk = false;
+static bool scanPendingFallback = false; // pending switch is a return, no confirm phase
+static uint32_t scanFallbackFreq = 0;    // old channel while the new one is unconfirmed
+static bool scanFallbackFsk = false;
+static bool scanConfirmed = false;
+static bool scanProbeReply = false;      // a peer's unconfirmed probe wants an answer
+static unsigned long scanConfirmStart = 0;
+static unsigned long scanProbeAt = 0;
+
+static void scanRecord(scan_channel_t &ch, int16_t rssi, int8_t busyThreshold)
+{
+    int bin = rssi < SCAN_BIN_BASE ? 0 : (rssi - SCAN_BIN_BASE) / SCAN_BIN_WIDTH + 1;
+    ch.bins[bin < SCAN_BINS ? bin : SCAN_BINS - 1]++;
+    if (ch.samples == 0 || rssi > ch.maxRssi)
+        ch.maxRssi = rssi;
+    ch.samples++;
+    ch.sumRssi += rssi;
+    if (rssi >= busyThreshold)
+        ch.busy++;
+}
+
+// Mean RSSI in dBm
+int16_t scanMean(const scan_channel_t &ch)
+{
+    return ch.samples ? ch.sumRssi / ch.samples : 0;
+}
+
+// Busy share in percent
+uint8_t scanBusy(const scan_channel_t &ch)
+{
+    return ch.samples ? ch.busy * 100 / ch.samples : 0;
+}
+
+// Channels a sweep with `stepHz` visits
+uint32_t scanChannelCount(uint32_t stepHz)
+{
+    return (SCAN_FREQ_MAX - SCAN_FREQ_MIN) / stepHz;
+}
+
+/*
+ * Sweeps all channels `stepHz` apart, scanChannelCount(stepHz) must not
+ * exceed SCAN_MAX_CHANNELS. Leaves the radio in standby on
+ * `homeFreq`; the caller re-arms RX. idle() runs once per channel.
+ */
+void scanRun(uint32_t stepHz, uint16_t dwellMs, int8_t busyThreshold, uint32_t homeFreq, void (*idle)())
+{
+    memset(scanChannels, 0, sizeof(scanChannels));
+    scanCount = 0;
+    for (uint32_t f = SCAN_FREQ_MIN + stepHz / 2; f + stepHz / 2 <= SCAN_FREQ_MAX && scanCount < SCAN_MAX_CHANNELS; f += stepHz)
+    {
+        scan_channel_t &ch = scanChannels[scanCount++];
+        ch.freq = f;
+        Radio.Standby();
+        Radio.SetChannel(f);
+        Radio.Rx(0);
+        delayMicroseconds(SCAN_SETTLE_US);
+        unsigned long start = millis();
+        while (millis() - start < dwellMs)
+        {
+            scanRecord(ch, Radio.Rssi(MODEM_LORA), busyThreshold);
+            delayMicroseconds(SCAN_SAMPLE_US);
+        }
+        idle();
+    }
+    Radio.Standby();
+    // Frames caught while scanning are not ours to handle
+    SX126xClearIrqStatus(IRQ_RADIO_ALL);
+    Radio.SetChannel(homeFreq);
+}
+
+// Index of the quietest channel, -1 before the first scan
+int scanBest()
+{
+    int best = -1;
+    for (int i = 0; i < scanCount; i++)
+    {
+        const scan_channel_t &ch = scanChannels[i];
+        if (best < 0 || scanBusy(ch) < scanBusy(scanChannels[best]) ||
+            (scanBusy(ch) == scanBusy(scanChannels[best]) && scanMean(ch) < scanMean(scanChannels[best])))
+            best = i;
+    }
+    return best;
+}
+
+void scanAnnounce(uint32_t freq, bool fsk)
+{
+    scanAnnounceFreq = freq;
+    scanAnnounceFsk = fsk;
+    scanAnnounceLeft = SCAN_ANNOUNCE_REPEATS;
+}
+
+// Next announcement is due; after the last one our own switch is queued
+bool scanAnnounceDue()
+{
+    if (scanAnnounceFreq == 0)
+        return false;
+    if (scanAnnounceLeft == 0)
+    {
+        scanPendingFreq = scanAnnounceFreq;
+        scanPendingFsk = scanAnnounceFsk;
+        scanAnnounceFreq = 0;
+        return false;
+    }
+    return true;
+}
+
+// Call once an announcement went out; a busy channel or slot retries it
+void scanAnnounceSent()
+{
+    if (scanAnnounceLeft > 0)
+        scanAnnounceLeft--;
+}
+
+// Announcing, switching or still waiting for a peer on the new channel
+bool scanSwitchBusy()
+{
+    return scanAnnounceFreq != 0 || scanPendingFreq != 0 || scanFallbackFreq != 0;
+}
+
+// Switched from `oldFreq` / `oldFsk`, wait for a peer on the new channel
+void scanStartConfirm(uint32_t oldFreq, bool oldFsk, unsigned long now)
+{
+    scanFallbackFreq = oldFreq;
+    scanFallbackFsk = oldFsk;
+    scanConfirmed = false;
+    scanConfirmStart = now;
+    scanProbeAt = now;
+}
+
+// Any frame of the link heard on the current channel
+void scanHeard()
+{
+    if (scanFallbackFreq != 0)
+        scanConfirmed = true;
+}
+
+// A peer's probe: answer it unless it already heard us
+void scanOnProbe(bool peerConfirmed)
+{
+    scanHeard();
+    if (!peerConfirmed)
+        scanProbeReply = true;
+}
+
+// Our probe or the answer to one is due
+bool scanProbeDue(unsigned long now)
+{
+    if (scanProbeReply)
+        return true;
+    return scanFallbackFreq != 0 && !scanConfirmed && (long)(now - scanProbeAt) >= 0;
+}
+
+void scanProbeSent(unsigned long now)
+{
+    scanProbeReply = false;
+    scanProbeAt = now + SCAN_PROBE_MS;
+}
+
+// Ends the confirm phase; queues the return to the old channel if nobody answered
+void scanConfirmCheck(unsigned long now)
+{
+    if (scanFallbackFreq == 0 || now - scanConfirmStart < SCAN_CONFIRM_MS)
+        return;
+    if (!scanConfirmed)
+    {
+        scanPendingFreq = scanFallbackFreq;
+        scanPendingFsk = scanFallbackFsk;
+        scanPendingFallback = true;
+    }
+    scanFallbackFreq = 0;
+}
@@ -3,6 +3,26 @@
 #include "LoRaWan_APP.h"
 #include "settings.h"
 #include <Preferences.h>
+#include "delta_codec.h"
+#include "lz_codec.h"
+#include "routing.h"
+#include "mesh.h"
+#include "tdma.h"
+#include "metrics.h"
+#include "timestamps.h"
+#include "trace_log.h"
+#include "health.h"
+#include "radio_sleep.h"
+#include "sniff.h"
+#include "channel_scan.h"
+#include "noise_floor.h"
+#include "rx_pool.h"
+#include "uart_egress.h"
+#include "flow_control.h"
+#include "driver/sx126x.h"
+#include "esp_task_wdt.h"
+#include "esp_attr.h"
+#include "esp_system.h"
 
 /*
  * Input value bounds checking
@@ -47,11 +67,52 @@
 #define LBT_RETRY_MAX 10
 
 #define MODBUS_BAUD_MIN 1200
-#define MODBUS_BAUD_MAX 115200
+#define MODBUS_BAUD_MAX 1000000
+#define HEALTH_LIMIT_MAX 262144
+#define SLEEP_PERIOD_MAX 86400000UL
+#define SLEEP_WINDOW_MIN 100
+#define SLEEP_WINDOW_MAX 60000
+#define SNIFF_SLEEP_MAX 10000
+#define RS485_PIN_MAX 48
+#define FSK_BITRATE_MIN 600
+#define FSK_BITRATE_MAX 300000
+#define FSK_FDEV_MIN 600
+#define FSK_FDEV_MAX 200000
+#define FSK_BANDWIDTH_MIN 4800
+#define FSK_BANDWIDTH_MAX 467000
+#define LBT_MARGIN_MIN 3
+#define LBT_MARGIN_MAX 30
+#define SCAN_STEP_MIN 25000
+#define SCAN_STEP_MAX 1000000
+#define SCAN_DWELL_MIN 10
+#define SCAN_DWELL_MAX 5000
+#define TRACE_DUMP_BAUD_MIN 1200
+#define TRACE_DUMP_BAUD_MAX 2000000
 
 #define MODBUS_DELAY_MIN 1
 #define MODBUS_DELAY_MAX 1000
 
+#define DELTA_RESYNC_MIN 1
+#define DELTA_RESYNC_MAX 255
+
+#define RELAY_ADDR_MIN 0
+#define RELAY_ADDR_MAX 254
+
+#define ROUTE_PROTO_MIN 0
+#define ROUTE_PROTO_MAX 1
+
+#define MESH_HOPS_MIN 1
+#define MESH_HOPS_MAX 15
+
+#define MESH_JITTER_MIN 0
+#define MESH_JITTER_MAX 5000
+
+#define TDMA_MODE_MIN 0
+#define TDMA_MODE_MAX 2
+
+#define TDMA_GUARD_MIN 0
+#define TDMA_GUARD_MAX 1000
+
 typedef struct
 {
     uint32_t rf_frequency;
@@ -78,6 +139,57 @@ typedef struct
     bool beaconEnabled;
     unsigned long beaconIntervalMs;
     unsigned long lastBeaconMillis;
+
+    // Link encoding
+    bool delta_enabled;
+    uint8_t delta_resync_interval;
+    bool lz_enabled;
+
+    // Routing
+    bool routing_enabled;
+    uint8_t relay_address;
+    uint8_t route_protocol;
+
+    // Mesh
+    bool mesh_enabled;
+    uint8_t mesh_max_hops;
+    uint16_t mesh_jitter_ms;
+
+    // TDMA
+    uint8_t tdma_mode;
+    uint16_t tdma_guard_ms;
+
+    // Boot
+    bool fast_boot;
+
+    // Warm sleep
+    uint32_t sleep_period_ms;
+    uint16_t sleep_window_ms;
+
+    // Duty-cycled RX
+    uint16_t sniff_sleep_ms;
+    uint16_t peer_sniff_ms;
+
+    // Hardware RS485 direction control / collision detection
+    uint8_t rs485_mode;
+    int8_t rs485_de_pin;
+
+    // Serial back-pressure
+    uint8_t flow_mode;
+    int8_t flow_rts_pin;
+    int8_t flow_cts_pin;
+
+    // LBT threshold from the noise floor
+    bool lbt_auto;
+    uint8_t lbt_margin;
+
+    // GFSK instead of LoRa
+    bool fsk_enabled;
+    uint32_t fsk_bitrate;
+    uint32_t fsk_fdev;
+    uint32_t fsk_bandwidth;
+    bool fsk_whitening;
+    bool fsk_crc;
 } device_config_t;
 
 device_config_t config = {
@@ -103,10 +215,101 @@ device_config_t config = {
     .beaconEnabled = false,
     .beaconIntervalMs = BEACON_INTERVAL_MS,
     .lastBeaconMillis = 0,
+
+    .delta_enabled = DELTA_ENABLED,
+    .delta_resync_interval = DELTA_RESYNC_INTERVAL,
+    .lz_enabled = LZ_ENABLED,
+
+    .routing_enabled = ROUTING_ENABLED,
+    .relay_address = RELAY_ADDRESS,
+    .route_protocol = ROUTE_PROTOCOL,
+
+    .mesh_enabled = MESH_ENABLED,
+    .mesh_max_hops = MESH_MAX_HOPS,
+    .mesh_jitter_ms = MESH_JITTER_MS,
+
+    .tdma_mode = TDMA_MODE,
+    .tdma_guard_ms = TDMA_GUARD_MS,
+
+    .fast_boot = FAST_BOOT,
+
+    .sleep_period_ms = SLEEP_PERIOD_MS,
+    .sleep_window_ms = SLEEP_WINDOW_MS,
+
+    .sniff_sleep_ms = SNIFF_SLEEP_MS,
+    .peer_sniff_ms = PEER_SNIFF_MS,
+
+    .rs485_mode = RS485_MODE,
+    .rs485_de_pin = RS485_DE_PIN,
+
+    .flow_mode = FLOW_MODE,
+    .flow_rts_pin = FLOW_RTS_PIN,
+    .flow_cts_pin = FLOW_CTS_PIN,
+
+    .lbt_auto = LBT_AUTO,
+    .lbt_margin = LBT_MARGIN_DB,
+
+    .fsk_enabled = FSK_ENABLED,
+    .fsk_bitrate = FSK_BITRATE,
+    .fsk_fdev = FSK_FDEV,
+    .fsk_bandwidth = FSK_BANDWIDTH,
+    .fsk_whitening = FSK_WHITENING,
+    .fsk_crc = FSK_CRC,
 };
 
 Preferences prefs;
 
+// Copy of the stored config that survives software resets, for fast boot
+RTC_NOINIT_ATTR static device_config_t rtcConfig;
+RTC_NOINIT_ATTR static uint32_t rtcConfigCheck;
+
+static uint32_t configChecksum(const device_config_t &c)
+{
+    // FNV-1a over the raw struct, salted so zeroed RTC memory never matches
+    uint32_t h = 2166136261u ^ RTC_CONFIG_MAGIC;
+    const uint8_t *p = (const uint8_t *)&c;
+    for (size_t i = 0; i < sizeof(c); i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+void rtcConfigStore()
+{
+    memcpy(&rtcConfig, &config, sizeof(config));
+    rtcConfigCheck = configChecksum(rtcConfig);
+}
+
+/*
+ * Takes the config from RTC memory instead of NVS. Only after a software,
+ * panic or watchdog reset with fast boot enabled; RTC memory does not survive
+ * power loss.
+ */
+bool rtcConfigRestore()
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+    if (reason == ESP_RST_POWERON || reason == ESP_RST_BROWNOUT || reason == ESP_RST_UNKNOWN)
+        return false;
+    if (rtcConfigCheck != configChecksum(rtcConfig) || !rtcConfig.fast_boot)
+        return false;
+    memcpy(&config, &rtcConfig, sizeof(config));
+    config.lastBeaconMillis = 0;
+    return true;
+}
+
+// True when both configs program the radio the same way
+bool radioConfigEqual(const device_config_t &a, const device_config_t &b)
+{
+    return a.rf_frequency == b.rf_frequency && a.tx_output_power == b.tx_output_power &&
+           a.lora_bandwidth == b.lora_bandwidth && a.lora_spreading_factor == b.lora_spreading_factor &&
+           a.lora_codingrate == b.lora_codingrate && a.lora_preamble_length == b.lora_preamble_length &&
+           a.lora_symbol_timeout == b.lora_symbol_timeout &&
+           a.lora_fix_length_payload_on == b.lora_fix_length_payload_on &&
+           a.lora_iq_inversion_on == b.lora_iq_inversion_on && a.tx_timeout == b.tx_timeout &&
+           a.peer_sniff_ms == b.peer_sniff_ms && a.sniff_sleep_ms == b.sniff_sleep_ms &&
+           a.fsk_enabled == b.fsk_enabled && a.fsk_bitrate == b.fsk_bitrate && a.fsk_fdev == b.fsk_fdev &&
+           a.fsk_bandwidth == b.fsk_bandwidth && a.fsk_whitening == b.fsk_whitening && a.fsk_crc == b.fsk_crc;
+}
+
 void loadConfig()
 {
     prefs.begin("device", false);
@@ -134,6 +337,57 @@ void loadConfig()
     config.beaconIntervalMs = prefs.getULong("beacon_int", BEACON_INTERVAL_MS);
     config.lastBeaconMillis = 0; // Always reset on boot
 
+    config.delta_enabled = prefs.getBool("delta", DELTA_ENABLED);
+    config.delta_resync_interval = prefs.getUChar("delta_rsync", DELTA_RESYNC_INTERVAL);
+    config.lz_enabled = prefs.getBool("lz", LZ_ENABLED);
+
+    config.routing_enabled = prefs.getBool("routing", ROUTING_ENABLED);
+    config.relay_address = prefs.getUChar("relay_addr", RELAY_ADDRESS);
+    config.route_protocol = prefs.getUChar("route_proto", ROUTE_PROTOCOL);
+    routeReset();
+    prefs.getBytes("route_tbl", routeTable, sizeof(routeTable));
+    prefs.getBytes("route_static", routeStatic, sizeof(routeStatic));
+    prefs.getBytes("route_owned", routeOwned, sizeof(routeOwned));
+    // Only static routes survive a reboot, learned ones are relearned
+    for (int i = 0; i < ROUTE_SLAVES; i++)
+    {
+        if (!routeBit(routeStatic, i))
+            routeTable[i] = ROUTE_BROADCAST;
+    }
+
+    config.mesh_enabled = prefs.getBool("mesh", MESH_ENABLED);
+    config.mesh_max_hops = prefs.getUChar("mesh_hops", MESH_MAX_HOPS);
+    config.mesh_jitter_ms = prefs.getUShort("mesh_jitter", MESH_JITTER_MS);
+
+    config.tdma_mode = prefs.getUChar("tdma", TDMA_MODE);
+    config.tdma_guard_ms = prefs.getUShort("tdma_guard", TDMA_GUARD_MS);
+    prefs.getBytes("tdma_slots", tdmaSlots, sizeof(tdmaSlots));
+    prefs.getBytes("tdma_count", &tdmaSlotCount, sizeof(tdmaSlotCount));
+
+    traceEnabled = prefs.getBool("trace", TRACE_ENABLED);
+    healthMinFree = prefs.getULong("heap_min", HEALTH_MIN_FREE_HEAP);
+    healthMinBlock = prefs.getULong("block_min", HEALTH_MIN_LARGEST_BLOCK);
+
+    config.fast_boot = prefs.getBool("fast_boot", FAST_BOOT);
+    config.sleep_period_ms = prefs.getULong("sleep_period", SLEEP_PERIOD_MS);
+    config.sleep_window_ms = prefs.getUShort("sleep_window", SLEEP_WINDOW_MS);
+    config.sniff_sleep_ms = prefs.getUShort("sniff", SNIFF_SLEEP_MS);
+    config.peer_sniff_ms = prefs.getUShort("peer_sniff", PEER_SNIFF_MS);
+    // Was a bool, stored as the same u8
+    config.rs485_mode = prefs.getUChar("rs485", RS485_MODE);
+    config.rs485_de_pin = prefs.getChar("rs485_de", RS485_DE_PIN);
+    config.flow_mode = prefs.getUChar("flow", FLOW_MODE);
+    config.flow_rts_pin = prefs.getChar("flow_rts", FLOW_RTS_PIN);
+    config.flow_cts_pin = prefs.getChar("flow_cts", FLOW_CTS_PIN);
+    config.lbt_auto = prefs.getBool("lbt_auto", LBT_AUTO);
+    config.lbt_margin = prefs.getUChar("lbt_margin", LBT_MARGIN_DB);
+    config.fsk_enabled = prefs.getBool("fsk", FSK_ENABLED);
+    config.fsk_bitrate = prefs.getULong("fsk_br", FSK_BITRATE);
+    config.fsk_fdev = prefs.getULong("fsk_fdev", FSK_FDEV);
+    config.fsk_bandwidth = prefs.getULong("fsk_bw", FSK_BANDWIDTH);
+    config.fsk_whitening = prefs.getBool("fsk_white", FSK_WHITENING);
+    config.fsk_crc = prefs.getBool("fsk_crc", FSK_CRC);
+
     prefs.end();
 }
 
@@ -162,11 +416,140 @@ void saveConfig()
     prefs.putBool("beacon", config.beaconEnabled);
     prefs.putULong("beacon_int", config.beaconIntervalMs);
 
+    prefs.putBool("delta", config.delta_enabled);
+    prefs.putUChar("delta_rsync", config.delta_resync_interval);
+    prefs.putBool("lz", config.lz_enabled);
+
+    prefs.putBool("routing", config.routing_enabled);
+    prefs.putUChar("relay_addr", config.relay_address);
+    prefs.putUChar("route_proto", config.route_protocol);
+    prefs.putBytes("route_tbl", routeTable, sizeof(routeTable));
+    prefs.putBytes("route_static", routeStatic, sizeof(routeStatic));
+    prefs.putBytes("route_owned", routeOwned, sizeof(routeOwned));
+
+    prefs.putBool("mesh", config.mesh_enabled);
+    prefs.putUChar("mesh_hops", config.mesh_max_hops);
+    prefs.putUShort("mesh_jitter", config.mesh_jitter_ms);
+
+    prefs.putUChar("tdma", config.tdma_mode);
+    prefs.putUShort("tdma_guard", config.tdma_guard_ms);
+    if (config.tdma_mode == TDMA_MODE_HEADEND)
+    {
+        prefs.putBytes("tdma_slots", tdmaSlots, sizeof(tdmaSlots));
+        prefs.putBytes("tdma_count", &tdmaSlotCount, sizeof(tdmaSlotCount));
+    }
+
+    prefs.putBool("trace", traceEnabled);
+    prefs.putULong("heap_min", healthMinFree);
+    prefs.putULong("block_min", healthMinBlock);
+
+    prefs.putBool("fast_boot", config.fast_boot);
+    prefs.putULong("sleep_period", config.sleep_period_ms);
+    prefs.putUShort("sleep_window", config.sleep_window_ms);
+    prefs.putUShort("sniff", config.sniff_sleep_ms);
+    prefs.putUShort("peer_sniff", config.peer_sniff_ms);
+    prefs.putUChar("rs485", config.rs485_mode);
+    prefs.putChar("rs485_de", config.rs485_de_pin);
+    prefs.putUChar("flow", config.flow_mode);
+    prefs.putChar("flow_rts", config.flow_rts_pin);
+    prefs.putChar("flow_cts", config.flow_cts_pin);
+    prefs.putBool("lbt_auto", config.lbt_auto);
+    prefs.putUChar("lbt_margin", config.lbt_margin);
+    prefs.putBool("fsk", config.fsk_enabled);
+    prefs.putULong("fsk_br", config.fsk_bitrate);
+    prefs.putULong("fsk_fdev", config.fsk_fdev);
+    prefs.putULong("fsk_bw", config.fsk_bandwidth);
+    prefs.putBool("fsk_white", config.fsk_whitening);
+    prefs.putBool("fsk_crc", config.fsk_crc);
+
     prefs.end();
+    rtcConfigStore();
+}
+
+// Preamble sent on air, stretched when the peer sniffs
+uint16_t txPreambleLength()
+{
+    return sniffPreamble(config.peer_sniff_ms, config.lora_spreading_factor, config.lora_bandwidth,
+                         config.lora_preamble_length);
+}
+
+// Packet parameters of the Heltec driver, defined in its radio.c
+extern SX126x_t SX126x;
+
+RadioModems_t radioModem()
+{
+    return config.fsk_enabled ? MODEM_FSK : MODEM_LORA;
+}
+
+// Same variable length frames with CRC as LoRa, so framing above is unchanged.
+// The driver always enables whitening, it is switched off in the packet
+// params it keeps and re-sends with every frame.
+void applyFskToRadio()
+{
+    Radio.Standby();
+    Radio.SetTxConfig(MODEM_FSK,
+                      config.tx_output_power,
+                      config.fsk_fdev,
+                      0, // bandwidth (RX only)
+                      config.fsk_bitrate,
+                      0, // coding rate (LoRa only)
+                      FSK_PREAMBLE_BYTES,
+                      false, // variable length
+                      config.fsk_crc,
+                      0, // Freq hop
+                      0, // Hop period
+                      false,
+                      config.tx_timeout);
+    Radio.SetRxConfig(MODEM_FSK,
+                      config.fsk_bandwidth,
+                      config.fsk_bitrate,
+                      0,
+                      config.fsk_bandwidth, // AFC bandwidth
+                      FSK_PREAMBLE_BYTES,
+                      0,
+                      false,
+                      0, // No fixed payload len
+                      config.fsk_crc,
+                      0, // Freq hop
+                      0, // Hop period
+                      false,
+                      true);
+    if (!config.fsk_whitening)
+    {
+        SX126x.PacketParams.Params.Gfsk.DcFree = RADIO_DC_FREE_OFF;
+        SX126xSetPacketParams(&SX126x.PacketParams);
+    }
+    Radio.SetChannel(config.rf_frequency);
+}
+
+// Threshold LBT uses: the tuned one with auto LBT once the floor is known
+int8_t lbtThreshold()
+{
+    return config.lbt_auto && noiseLbtValid ? noiseLbt : config.lbt_rssi_threshold;
 }
 
 void applyConfigToRadio()
 {
+    // The noise floor belongs to one channel and modem
+    static uint32_t noiseFreq = 0;
+    static bool noiseFsk = false;
+    if (config.rf_frequency != noiseFreq || config.fsk_enabled != noiseFsk)
+    {
+        noiseReset();
+        noiseFreq = config.rf_frequency;
+        noiseFsk = config.fsk_enabled;
+    }
+    if (config.fsk_enabled)
+    {
+        applyFskToRadio();
+        return;
+    }
+
+    // The driver keeps one set of packet params for TX and RX, so both get the
+    // long preamble; a receiver still locks onto shorter ones
+    uint16_t preamble = txPreambleLength();
+    uint32_t stretchMs = (uint32_t)(preamble - config.lora_preamble_length) *
+                         sniffSymbolUs(config.lora_spreading_factor, config.lora_bandwidth) / 1000;
     Radio.Standby();
     Radio.SetTxConfig(MODEM_LORA,
                       config.tx_output_power,
@@ -174,19 +557,19 @@ void applyConfigToRadio()
                       config.lora_bandwidth,
                       config.lora_spreading_factor,
                       config.lora_codingrate,
-                      config.lora_preamble_length,
+                      preamble,
                       config.lora_fix_length_payload_on,
                       true, // CRC on
                       0,    // Freq hop
                       0,    // Hop period
                       config.lora_iq_inversion_on,
-                      config.tx_timeout);
+                      config.tx_timeout + stretchMs);
     Radio.SetRxConfig(MODEM_LORA,
                       config.lora_bandwidth,
                       config.lora_spreading_factor,
                       config.lora_codingrate,
                       0,
-                      config.lora_preamble_length,
+                      preamble,
                       config.lora_symbol_timeout,
                       config.lora_fix_length_payload_on,
                       0,    // No fixed payload len
@@ -442,12 +825,738 @@ void handleATCommand(const String &cmd)
             Serial.println("ERR: Interval must be 1000 to 60000 ms");
         }
     }
+    else if (cmd.startsWith("AT+DELTA="))
+    {
+        int value = cmd.substring(strlen("AT+DELTA=")).toInt();
+        if (value >= LORA_BOOL_MIN && value <= LORA_BOOL_MAX)
+        {
+            config.delta_enabled = value;
+            deltaReset();
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.println("ERR: Delta must be 0 or 1");
+        }
+    }
+    else if (cmd.startsWith("AT+SETDELTARESYNC="))
+    {
+        int value = cmd.substring(strlen("AT+SETDELTARESYNC=")).toInt();
+        if (value >= DELTA_RESYNC_MIN && value <= DELTA_RESYNC_MAX)
+        {
+            config.delta_resync_interval = value;
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.printf("ERR: Resync interval must be between %d and %d\n", DELTA_RESYNC_MIN, DELTA_RESYNC_MAX);
+        }
+    }
+    else if (cmd == "AT+DELTASTATS")
+    {
+        // Ratios are raw/air in hundredths, one line per link direction
+        Serial.printf("TX,raw=%lu,air=%lu,full=%lu,delta=%lu,ratio=%lu\n",
+                      deltaStats.txRawBytes, deltaStats.txAirBytes, deltaStats.txFull, deltaStats.txDelta,
+                      deltaRatio(deltaStats.txRawBytes, deltaStats.txAirBytes));
+        Serial.printf("RX,raw=%lu,air=%lu,full=%lu,delta=%lu,ratio=%lu,dropped=%lu,resync=%lu\n",
+                      deltaStats.rxRawBytes, deltaStats.rxAirBytes, deltaStats.rxFull, deltaStats.rxDelta,
+                      deltaRatio(deltaStats.rxRawBytes, deltaStats.rxAirBytes),
+                      deltaStats.rxDropped, deltaStats.resyncRequests);
+        Serial.println("OK");
+    }
+    else if (cmd.startsWith("AT+LZ="))
+    {
+        int value = cmd.substring(strlen("AT+LZ=")).toInt();
+        if (value >= LORA_BOOL_MIN && value <= LORA_BOOL_MAX)
+        {
+            config.lz_enabled = value;
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.println("ERR: LZ must be 0 or 1");
+        }
+    }
+    else if (cmd == "AT+LZSTATS")
+    {
+        // Ratios are in/out in hundredths, raw counts frames sent uncompressed
+        Serial.printf("TX,in=%lu,out=%lu,compressed=%lu,raw=%lu,ratio=%lu\n",
+                      lzStats.txInBytes, lzStats.txOutBytes, lzStats.txCompressed, lzStats.txRaw,
+                      deltaRatio(lzStats.txInBytes, lzStats.txOutBytes));
+        Serial.printf("RX,in=%lu,out=%lu,ratio=%lu,errors=%lu\n",
+                      lzStats.rxInBytes, lzStats.rxOutBytes,
+                      deltaRatio(lzStats.rxOutBytes, lzStats.rxInBytes), lzStats.rxErrors);
+        Serial.println("OK");
+    }
+    else if (cmd.startsWith("AT+ROUTING="))
+    {
+        int value = cmd.substring(strlen("AT+ROUTING=")).toInt();
+        if (value >= LORA_BOOL_MIN && value <= LORA_BOOL_MAX)
+        {
+            config.routing_enabled = value;
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.println("ERR: Routing must be 0 or 1");
+        }
+    }
+    else if (cmd.startsWith("AT+SETADDR="))
+    {
+        int value = cmd.substring(strlen("AT+SETADDR=")).toInt();
+        if (value >= RELAY_ADDR_MIN && value <= RELAY_ADDR_MAX)
+        {
+            config.relay_address = value;
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.printf("ERR: Address must be between %d and %d\n", RELAY_ADDR_MIN, RELAY_ADDR_MAX);
+        }
+    }
+    else if (cmd.startsWith("AT+SETROUTEPROTO="))
+    {
+        int value = cmd.substring(strlen("AT+SETROUTEPROTO=")).toInt();
+        if (value >= ROUTE_PROTO_MIN && value <= ROUTE_PROTO_MAX)
+        {
+            config.route_protocol = value;
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.println("ERR: Protocol must be 0 (Modbus) or 1 (M-Bus)");
+        }
+    }
+    else if (cmd.startsWith("AT+ROUTE="))
+    {
+        String args = cmd.substring(strlen("AT+ROUTE="));
+        int comma = args.indexOf(',');
+        int slave = args.substring(0, comma).toInt();
+        int relay = args.substring(comma + 1).toInt();
+        if (comma > 0 && slave >= 0 && slave < ROUTE_SLAVES && relay >= RELAY_ADDR_MIN && relay <= ROUTE_BROADCAST)
+        {
+            routeSetStatic(slave, relay);
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.println("ERR: Use AT+ROUTE=<slave 0-255>,<relay 0-254|255 to clear>");
+        }
+    }
+    else if (cmd.startsWith("AT+OWN="))
+    {
+        String args = cmd.substring(strlen("AT+OWN="));
+        int comma = args.indexOf(',');
+        int slave = args.substring(0, comma).toInt();
+        int owned = args.substring(comma + 1).toInt();
+        if (comma > 0 && slave >= 0 && slave < ROUTE_SLAVES && owned >= LORA_BOOL_MIN && owned <= LORA_BOOL_MAX)
+        {
+            routeSetOwned(slave, owned);
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.println("ERR: Use AT+OWN=<slave 0-255>,<0|1>");
+        }
+    }
+    else if (cmd == "AT+ROUTES")
+    {
+        for (int i = 0; i < ROUTE_SLAVES; i++)
+        {
+            if (routeTable[i] != ROUTE_BROADCAST)
+                Serial.printf("ROUTE,%d,%u,%s\n", i, routeTable[i], routeBit(routeStatic, i) ? "static" : "learned");
+            if (routeOwns(i))
+                Serial.printf("OWN,%d\n", i);
+        }
+        Serial.printf("STATS,accepted=%lu,foreign=%lu,learned=%lu,broadcast=%lu\n",
+                      routeStats.accepted, routeStats.foreignDropped, routeStats.learned, routeStats.broadcastTx);
+        Serial.println("OK");
+    }
+    else if (cmd.startsWith("AT+MESH="))
+    {
+        int value = cmd.substring(strlen("AT+MESH=")).toInt();
+        if (value >= LORA_BOOL_MIN && value <= LORA_BOOL_MAX)
+        {
+            config.mesh_enabled = value;
+            if (value)
+                config.routing_enabled = true; // mesh header extends the routing header
+            meshReset();
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.println("ERR: Mesh must be 0 or 1");
+        }
+    }
+    else if (cmd.startsWith("AT+SETMESHHOPS="))
+    {
+        int value = cmd.substring(strlen("AT+SETMESHHOPS=")).toInt();
+        if (value >= MESH_HOPS_MIN && value <= MESH_HOPS_MAX)
+        {
+            config.mesh_max_hops = value;
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.printf("ERR: Hops must be between %d and %d\n", MESH_HOPS_MIN, MESH_HOPS_MAX);
+        }
+    }
+    else if (cmd.startsWith("AT+SETMESHJITTER="))
+    {
+        int value = cmd.substring(strlen("AT+SETMESHJITTER=")).toInt();
+        if (value >= MESH_JITTER_MIN && value <= MESH_JITTER_MAX)
+        {
+            config.mesh_jitter_ms = value;
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.printf("ERR: Jitter must be between %d and %d ms\n", MESH_JITTER_MIN, MESH_JITTER_MAX);
+        }
+    }
+    else if (cmd == "AT+MESHROUTES")
+    {
+        unsigned long now = millis();
+        for (int i = 0; i < MESH_ROUTES; i++)
+        {
+            const mesh_route_t &r = meshRoutes[i];
+            if (r.valid)
+                Serial.printf("ROUTE,%u,via=%u,hops=%u,rssi=%d,snr=%d,age=%lu\n",
+                              r.dest, r.nextHop, r.hops, r.rssi, r.snr, (now - r.lastSeen) / 1000);
+        }
+        Serial.printf("STATS,originated=%lu,delivered=%lu,duplicates=%lu,forwarded=%lu,queue_full=%lu,ttl_expired=%lu\n",
+                      meshStats.originated, meshStats.delivered, meshStats.duplicates,
+                      meshStats.forwarded, meshStats.queueFull, meshStats.ttlExpired);
+        Serial.println("OK");
+    }
+    else if (cmd.startsWith("AT+TDMA="))
+    {
+        int value = cmd.substring(strlen("AT+TDMA=")).toInt();
+        if (value >= TDMA_MODE_MIN && value <= TDMA_MODE_MAX)
+        {
+            config.tdma_mode = value;
+            tdmaSynced = false;
+            tdmaResetStats();
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.println("ERR: TDMA mode must be 0 (off), 1 (member) or 2 (head-end)");
+        }
+    }
+    else if (cmd.startsWith("AT+TDMASLOT="))
+    {
+        // AT+TDMASLOT=<index>,<relay>,<expected frame bytes, 0 clears>
+        String args = cmd.substring(strlen("AT+TDMASLOT="));
+        int first = args.indexOf(',');
+        int second = args.indexOf(',', first + 1);
+        int index = args.substring(0, first).toInt();
+        int relay = args.substring(first + 1, second).toInt();
+        int bytes = args.substring(second + 1).toInt();
+        if (first > 0 && second > first && index >= 0 && index < TDMA_MAX_SLOTS &&
+            relay >= RELAY_ADDR_MIN && relay <= RELAY_ADDR_MAX && bytes >= 0 && bytes < LORA_BUFFER)
+        {
+            tdmaSetSlot(index, relay, bytes);
+            tdmaResetStats();
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.printf("ERR: Use AT+TDMASLOT=<0-%d>,<relay>,<bytes 0-%d>\n", TDMA_MAX_SLOTS - 1, LORA_BUFFER - 1);
+        }
+    }
+    else if (cmd.startsWith("AT+SETTDMAGUARD="))
+    {
+        int value = cmd.substring(strlen("AT+SETTDMAGUARD=")).toInt();
+        if (value >= TDMA_GUARD_MIN && value <= TDMA_GUARD_MAX)
+        {
+            config.tdma_guard_ms = value;
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.printf("ERR: Guard must be between %d and %d ms\n", TDMA_GUARD_MIN, TDMA_GUARD_MAX);
+        }
+    }
+    else if (cmd == "AT+TDMASTATS")
+    {
+        Serial.printf("SF,period=%lu,beacon=%u,count=%lu,synced=%d,outside=%lu\n",
+                      tdmaSuperframeMs(), tdmaBeaconSlotMs, tdmaSuperframes, tdmaSynced, tdmaOutsideSlots);
+        for (uint8_t i = 0; i < tdmaSlotCount; i++)
+        {
+            Serial.printf("SLOT,%u,owner=%u,dur=%u,tx=%lu,rx=%lu,busy=%lu,util=%lu\n",
+                          i, tdmaSlots[i].owner, tdmaSlots[i].durationMs, tdmaSlotStats[i].txFrames,
+                          tdmaSlotStats[i].rxFrames, tdmaSlotStats[i].busyMs, tdmaUtilisation(i));
+        }
+        Serial.println("OK");
+    }
+    else if (cmd == "AT+LATENCY")
+    {
+        for (uint8_t i = 0; i < STAGE_COUNT; i++)
+        {
+            const stage_stat_t &st = stageStats[i];
+            Serial.printf("STAGE,%s,last=%lu,avg=%lu,max=%lu,count=%lu\n", stageNames[i], st.lastUs,
+                          st.count ? (uint32_t)(st.sumUs / st.count) : 0, st.maxUs, st.count);
+        }
+        Serial.printf("CLOCK,now=%lld,preamble=%lld,header=%lld,rx_done=%lld,tx_done=%lld\n",
+                      esp_timer_get_time(), rxTrace.preambleUs, rxTrace.headerUs, rxTrace.rxDoneUs, txAir.txDoneUs);
+        Serial.println("OK");
+    }
+    else if (cmd == "AT+LATENCY=RESET")
+    {
+        tsReset();
+        Serial.println("OK");
+    }
+    else if (cmd == "AT+STATS")
+    {
+        Serial.printf("COUNT,ser_in=%lu,ser_in_b=%lu,ser_out=%lu,ser_out_b=%lu,air_tx=%lu,air_tx_b=%lu,air_rx=%lu,air_rx_b=%lu\n",
+                      metrics.serialFramesIn, metrics.serialBytesIn, metrics.serialFramesOut, metrics.serialBytesOut,
+                      metrics.airFramesTx, metrics.airBytesTx, metrics.airFramesRx, metrics.airBytesRx);
+        Serial.printf("ERRS,lbt_fail=%lu,tx_timeout=%lu,crc=%lu,truncated=%lu,uart_overrun=%lu,rx_pool_full=%lu\n",
+                      metrics.lbtFail, metrics.txTimeout, metrics.crcError, metrics.truncated, metrics.uartOverrun,
+                      rxPoolFull);
+        Serial.printf("POOL,slots=%u,pending=%u,peak=%u\n", RX_POOL_SLOTS, rxPoolPending(), rxPoolPeak);
+        Serial.printf("EGRESS,frames=%lu,deferred=%lu,drains=%lu,collisions=%lu,echo_lost=%lu\n", egressStats.frames,
+                      egressStats.deferred, egressStats.drains, egressStats.collisions, egressStats.echoLost);
+        Serial.printf("FLOW,stops=%lu,max_backlog=%lu,stopped=%u\n", flowStats.stops, flowStats.maxBacklog, flowStopped);
+        metricsPrintHist("ser2air_us", "log2", histSerialToAir);
+        metricsPrintHist("air2ser_us", "log2", histAirToSerial);
+        metricsPrintHist("lbt_us", "log2", histLbtWait);
+        metricsPrintHist("rssi_dbm", "lin:-140:8", histRssi);
+        metricsPrintHist("snr_db", "lin:-20:2", histSnr);
+        Serial.println("OK");
+    }
+    else if (cmd == "AT+STATS=RESET")
+    {
+        metricsReset();
+        Serial.println("OK");
+    }
+    else if (cmd == "AT+HEALTH")
+    {
+        health_sample_t h;
+        healthSample(&h);
+        Serial.printf("HEAP,free=%lu,min=%lu,largest=%lu,frag=%u,used_blocks=%lu,free_blocks=%lu,failed=%lu\n",
+                      h.freeBytes, h.minFreeBytes, h.largestBlock, h.fragmentation, h.allocatedBlocks,
+                      h.freeBlocks, healthFailedAllocs);
+        Serial.printf("STACK,loop=%lu\n", h.stackFree);
+        Serial.printf("LIMIT,heap=%lu,block=%lu,stack=%u,trips=%u\n", healthMinFree, healthMinBlock,
+                      HEALTH_MIN_STACK, healthTrips);
+        Serial.println("OK");
+    }
+    else if (cmd.startsWith("AT+SETHEAPMIN="))
+    {
+        long value = cmd.substring(strlen("AT+SETHEAPMIN=")).toInt();
+        if (value >= 0 && value <= HEALTH_LIMIT_MAX)
+        {
+            healthMinFree = value;
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.printf("ERR: Limit must be between 0 and %d bytes\n", HEALTH_LIMIT_MAX);
+        }
+    }
+    else if (cmd.startsWith("AT+SETBLOCKMIN="))
+    {
+        long value = cmd.substring(strlen("AT+SETBLOCKMIN=")).toInt();
+        if (value >= 0 && value <= HEALTH_LIMIT_MAX)
+        {
+            healthMinBlock = value;
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.printf("ERR: Limit must be between 0 and %d bytes\n", HEALTH_LIMIT_MAX);
+        }
+    }
+    else if (cmd.startsWith("AT+FASTBOOT="))
+    {
+        int value = cmd.substring(strlen("AT+FASTBOOT=")).toInt();
+        if (value >= LORA_BOOL_MIN && value <= LORA_BOOL_MAX)
+        {
+            config.fast_boot = value;
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.println("ERR: Fast boot must be 0 or 1");
+        }
+    }
+    else if (cmd.startsWith("AT+SLEEPSCHED="))
+    {
+        String params = cmd.substring(strlen("AT+SLEEPSCHED="));
+        int comma = params.indexOf(',');
+        unsigned long period = params.toInt();
+        long window = comma >= 0 ? params.substring(comma + 1).toInt() : config.sleep_window_ms;
+        if (period > SLEEP_PERIOD_MAX)
+        {
+            Serial.printf("ERR: Period must be between 0 and %lu ms\n", SLEEP_PERIOD_MAX);
+        }
+        else if (window < SLEEP_WINDOW_MIN || window > SLEEP_WINDOW_MAX)
+        {
+            Serial.printf("ERR: Window must be between %d and %d ms\n", SLEEP_WINDOW_MIN, SLEEP_WINDOW_MAX);
+        }
+        else
+        {
+            config.sleep_period_ms = period;
+            config.sleep_window_ms = window;
+            sleepOnTraffic(millis());
+            Serial.println("OK");
+        }
+    }
+    else if (cmd == "AT+SLEEPSTATS")
+    {
+        Serial.printf("SLEEP,period=%lu,window=%u,asleep=%d,count=%lu,early=%lu,slept_ms=%llu,duty=%lu\n",
+                      config.sleep_period_ms, config.sleep_window_ms, sleepAsleep, sleepStats.sleeps,
+                      sleepStats.earlyWakes, sleepStats.asleepMs, sleepDuty(millis()));
+        Serial.printf("WAKE,last=%lu,avg=%lu,max=%lu\n", sleepStats.wakeLastUs,
+                      sleepStats.sleeps > sleepAsleep ? (uint32_t)(sleepStats.wakeSumUs / (sleepStats.sleeps - sleepAsleep)) : 0,
+                      sleepStats.wakeMaxUs);
+        Serial.println("OK");
+    }
+    else if (cmd.startsWith("AT+SNIFF="))
+    {
+        long value = cmd.substring(strlen("AT+SNIFF=")).toInt();
+        if (value > 0 && config.fsk_enabled)
+        {
+            Serial.println("ERR: Sniff mode needs LoRa");
+        }
+        else if (value >= 0 && value <= SNIFF_SLEEP_MAX)
+        {
+            // Peers hear about it first; without framing they need AT+PEERSNIFF
+            if (config.delta_enabled || config.lz_enabled || config.tdma_mode != TDMA_MODE_OFF)
+                sniffAnnounce(value);
+            else
+                sniffPendingMs = value;
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.printf("ERR: Sleep must be between 0 and %d ms\n", SNIFF_SLEEP_MAX);
+        }
+    }
+    else if (cmd.startsWith("AT+PEERSNIFF="))
+    {
+        long value = cmd.substring(strlen("AT+PEERSNIFF=")).toInt();
+        if (value > 0 && config.fsk_enabled)
+        {
+            Serial.println("ERR: Sniff mode needs LoRa");
+        }
+        else if (value >= 0 && value <= SNIFF_SLEEP_MAX)
+        {
+            config.peer_sniff_ms = value;
+            applyConfigToRadio();
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.printf("ERR: Sleep must be between 0 and %d ms\n", SNIFF_SLEEP_MAX);
+        }
+    }
+    else if (cmd == "AT+SNIFFINFO")
+    {
+        uint8_t sf = config.lora_spreading_factor, bw = config.lora_bandwidth;
+        uint16_t preamble = txPreambleLength();
+        // duty in hundredths of a percent, added = extra preamble airtime per frame
+        Serial.printf("RX,sleep=%u,window_us=%lu,duty=%lu,symbol_us=%lu\n", config.sniff_sleep_ms,
+                      sniffRxUs(sf, bw), sniffDuty(config.sniff_sleep_ms, sf, bw), sniffSymbolUs(sf, bw));
+        Serial.printf("TX,peer_sleep=%u,preamble=%u,added_ms=%lu\n", config.peer_sniff_ms, preamble,
+                      (uint32_t)(preamble - config.lora_preamble_length) * sniffSymbolUs(sf, bw) / 1000);
+        Serial.println("OK");
+    }
+    else if (cmd.startsWith("AT+RS485="))
+    {
+        String params = cmd.substring(strlen("AT+RS485="));
+        int comma = params.indexOf(',');
+        long mode = params.toInt();
+        long pin = comma >= 0 ? params.substring(comma + 1).toInt() : config.rs485_de_pin;
+        if (mode < RS485_OFF || mode > RS485_ECHO)
+        {
+            Serial.println("ERR: RS485 must be 0 (off), 1 (DE/RE) or 2 (collision detect)");
+        }
+        else if (mode == RS485_DE && (pin < 0 || pin > RS485_PIN_MAX))
+        {
+            Serial.printf("ERR: DE pin must be between 0 and %d\n", RS485_PIN_MAX);
+        }
+        else if (mode != RS485_OFF && config.flow_mode == FLOW_RTSCTS)
+        {
+            Serial.println("ERR: RS485 cannot be used with RTS/CTS flow control");
+        }
+        else
+        {
+            // Nothing may be in flight while the UART changes mode
+            Serial.flush();
+            if (rs485Apply(mode, pin))
+            {
+                config.rs485_mode = mode;
+                config.rs485_de_pin = pin;
+                Serial.println("OK");
+            }
+            else
+            {
+                rs485Apply(config.rs485_mode, config.rs485_de_pin);
+                Serial.println("ERR: UART refused the RS485 mode");
+            }
+        }
+    }
+    else if (cmd.startsWith("AT+FLOW="))
+    {
+        String params = cmd.substring(strlen("AT+FLOW="));
+        int first = params.indexOf(','), second = params.indexOf(',', first + 1);
+        long mode = params.toInt();
+        long rts = first >= 0 ? params.substring(first + 1).toInt() : config.flow_rts_pin;
+        long cts = second >= 0 ? params.substring(second + 1).toInt() : config.flow_cts_pin;
+        if (mode < FLOW_OFF || mode > FLOW_XONXOFF)
+        {
+            Serial.println("ERR: Flow control must be 0 (off), 1 (RTS/CTS) or 2 (XON/XOFF)");
+        }
+        else if (mode == FLOW_RTSCTS && (rts < 0 || rts > RS485_PIN_MAX || cts < 0 || cts > RS485_PIN_MAX))
+        {
+            Serial.printf("ERR: RTS and CTS pins must be between 0 and %d\n", RS485_PIN_MAX);
+        }
+        else if (mode == FLOW_RTSCTS && config.rs485_mode != RS485_OFF)
+        {
+            Serial.println("ERR: RS485 cannot be used with RTS/CTS flow control");
+        }
+        else
+        {
+            Serial.flush();
+            if (flowApply(mode, rts, cts))
+            {
+                config.flow_mode = mode;
+                config.flow_rts_pin = rts;
+                config.flow_cts_pin = cts;
+                Serial.println("OK");
+            }
+            else
+            {
+                flowApply(config.flow_mode, config.flow_rts_pin, config.flow_cts_pin);
+                Serial.println("ERR: UART refused the flow control pins");
+            }
+        }
+    }
+    else if (cmd.startsWith("AT+MODEM="))
+    {
+        String arg = cmd.substring(strlen("AT+MODEM="));
+        if (arg != "LORA" && arg != "FSK")
+        {
+            Serial.println("ERR: Modem must be LORA or FSK");
+        }
+        else if (arg == "FSK" && (config.sniff_sleep_ms > 0 || config.peer_sniff_ms > 0))
+        {
+            Serial.println("ERR: Turn off sniff mode first");
+        }
+        else if (scanSwitchBusy())
+        {
+            Serial.println("ERR: Channel or modem change in progress");
+        }
+        else if ((arg == "FSK") == config.fsk_enabled)
+        {
+            Serial.println("OK");
+        }
+        else if (config.delta_enabled || config.lz_enabled || config.tdma_mode != TDMA_MODE_OFF)
+        {
+            // Peers follow through the channel frame, see channel_scan.h
+            scanAnnounce(config.rf_frequency, arg == "FSK");
+            Serial.println("OK");
+        }
+        else
+        {
+            // No link framing for control frames: this relay only
+            config.fsk_enabled = arg == "FSK";
+            applyConfigToRadio();
+            Serial.println("OK");
+        }
+    }
+    else if (cmd.startsWith("AT+FSK="))
+    {
+        // <bitrate>,<fdev>,<rxbw>[,<whitening>,<crc>]
+        String params = cmd.substring(strlen("AT+FSK="));
+        int c1 = params.indexOf(','), c2 = params.indexOf(',', c1 + 1);
+        int c3 = params.indexOf(',', c2 + 1), c4 = params.indexOf(',', c3 + 1);
+        long bitrate = params.toInt();
+        long fdev = c1 >= 0 ? params.substring(c1 + 1).toInt() : -1;
+        long bw = c2 >= 0 ? params.substring(c2 + 1).toInt() : -1;
+        bool whitening = c3 >= 0 ? params.substring(c3 + 1).toInt() != 0 : config.fsk_whitening;
+        bool crc = c4 >= 0 ? params.substring(c4 + 1).toInt() != 0 : config.fsk_crc;
+        if (bitrate < FSK_BITRATE_MIN || bitrate > FSK_BITRATE_MAX)
+        {
+            Serial.printf("ERR: Bit rate must be between %d and %d bps\n", FSK_BITRATE_MIN, FSK_BITRATE_MAX);
+        }
+        else if (fdev < FSK_FDEV_MIN || fdev > FSK_FDEV_MAX)
+        {
+            Serial.printf("ERR: Deviation must be between %d and %d Hz\n", FSK_FDEV_MIN, FSK_FDEV_MAX);
+        }
+        else if (bw < FSK_BANDWIDTH_MIN || bw > FSK_BANDWIDTH_MAX)
+        {
+            Serial.printf("ERR: RX bandwidth must be between %d and %d Hz\n", FSK_BANDWIDTH_MIN, FSK_BANDWIDTH_MAX);
+        }
+        else if (bw < 2 * fdev + bitrate)
+        {
+            Serial.println("ERR: RX bandwidth must be at least 2 * deviation + bit rate");
+        }
+        else
+        {
+            config.fsk_bitrate = bitrate;
+            config.fsk_fdev = fdev;
+            config.fsk_bandwidth = bw;
+            config.fsk_whitening = whitening;
+            config.fsk_crc = crc;
+            applyConfigToRadio();
+            Serial.println("OK");
+        }
+    }
+    else if (cmd.startsWith("AT+LBTAUTO="))
+    {
+        String params = cmd.substring(strlen("AT+LBTAUTO="));
+        int comma = params.indexOf(',');
+        long enable = params.toInt();
+        long margin = comma >= 0 ? params.substring(comma + 1).toInt() : config.lbt_margin;
+        if (enable != 0 && enable != 1)
+        {
+            Serial.println("ERR: Auto LBT must be 0 or 1");
+        }
+        else if (margin < LBT_MARGIN_MIN || margin > LBT_MARGIN_MAX)
+        {
+            Serial.printf("ERR: Margin must be between %d and %d dB\n", LBT_MARGIN_MIN, LBT_MARGIN_MAX);
+        }
+        else
+        {
+            config.lbt_auto = enable;
+            config.lbt_margin = margin;
+            Serial.println("OK");
+        }
+    }
+    else if (cmd == "AT+NOISE")
+    {
+        Serial.printf("NOISE,floor=%d,p50=%d,p90=%d,samples=%u,total=%lu\n", noiseFloor(), noiseQuantile(50),
+                      noiseQuantile(90), noiseCount, noiseTotal);
+        Serial.printf("LBT,threshold=%d,static=%d,auto=%u,margin=%u,target=%d\n", lbtThreshold(),
+                      config.lbt_rssi_threshold, config.lbt_auto, config.lbt_margin, noiseThreshold(config.lbt_margin));
+        Serial.println("OK");
+    }
+    else if (cmd == "AT+SCAN" || cmd.startsWith("AT+SCAN="))
+    {
+        String params = cmd.length() > strlen("AT+SCAN") ? cmd.substring(strlen("AT+SCAN=")) : "";
+        int comma = params.indexOf(',');
+        long dwell = params.length() ? params.toInt() : SCAN_DWELL_MS;
+        long step = comma >= 0 ? params.substring(comma + 1).toInt() * 1000 : SCAN_STEP_HZ;
+        if (dwell < SCAN_DWELL_MIN || dwell > SCAN_DWELL_MAX)
+        {
+            Serial.printf("ERR: Dwell must be between %d and %d ms\n", SCAN_DWELL_MIN, SCAN_DWELL_MAX);
+        }
+        else if (step < SCAN_STEP_MIN || step > SCAN_STEP_MAX)
+        {
+            Serial.printf("ERR: Step must be between %d and %d kHz\n", SCAN_STEP_MIN / 1000, SCAN_STEP_MAX / 1000);
+        }
+        else if (scanChannelCount(step) > SCAN_MAX_CHANNELS)
+        {
+            // A partial sweep would report BEST for part of the band only
+            Serial.printf("ERR: Step needs %lu channels, at most %d fit (%lu kHz or more)\n", scanChannelCount(step),
+                          SCAN_MAX_CHANNELS, ((SCAN_FREQ_MAX - SCAN_FREQ_MIN) / SCAN_MAX_CHANNELS + 999) / 1000);
+        }
+        else
+        {
+            scanRun(step, dwell, lbtThreshold(), config.rf_frequency, []() { esp_task_wdt_reset(); });
+            // Bins of 10 dB from below -120 dBm to -60 dBm and up
+            for (uint8_t i = 0; i < scanCount; i++)
+            {
+                const scan_channel_t &ch = scanChannels[i];
+                Serial.printf("CH,%lu,n=%u,mean=%d,max=%d,busy=%u,b=", ch.freq, ch.samples, scanMean(ch), ch.maxRssi,
+                              scanBusy(ch));
+                for (uint8_t b = 0; b < SCAN_BINS; b++)
+                    Serial.printf(b ? "/%u" : "%u", ch.bins[b]);
+                Serial.println();
+            }
+            int best = scanBest();
+            if (best >= 0)
+                Serial.printf("BEST,%lu,busy=%u,mean=%d\n", scanChannels[best].freq, scanBusy(scanChannels[best]),
+                              scanMean(scanChannels[best]));
+            Serial.println("OK");
+        }
+    }
+    else if (cmd.startsWith("AT+CHANNEL="))
+    {
+        String arg = cmd.substring(strlen("AT+CHANNEL="));
+        int best = scanBest();
+        long freq = arg == "BEST" ? (best >= 0 ? scanChannels[best].freq : 0) : arg.toInt();
+        if (freq < SCAN_FREQ_MIN || freq > SCAN_FREQ_MAX)
+        {
+            Serial.printf("ERR: Frequency must be between %d and %d Hz (run AT+SCAN for BEST)\n", SCAN_FREQ_MIN, SCAN_FREQ_MAX);
+        }
+        else if (!config.delta_enabled && !config.lz_enabled && config.tdma_mode == TDMA_MODE_OFF)
+        {
+            Serial.println("ERR: Channel change needs link framing (delta, LZ or TDMA)");
+        }
+        else if (scanSwitchBusy())
+        {
+            Serial.println("ERR: Channel or modem change in progress");
+        }
+        else
+        {
+            scanAnnounce(freq, config.fsk_enabled);
+            Serial.println("OK");
+        }
+    }
+    else if (cmd == "AT+BOOTTIME")
+    {
+        Serial.printf("BOOT,reset=%d,warm=%d\n", esp_reset_reason(), bootWarm);
+        for (uint8_t i = 0; i < BOOT_COUNT; i++)
+        {
+            int64_t prev = i ? bootStageUs[i - 1] : 0;
+            Serial.printf("STEP,%s,at=%lld,took=%lld\n", bootStageNames[i], bootStageUs[i], bootStageUs[i] - prev);
+        }
+        Serial.println("OK");
+    }
+    else if (cmd.startsWith("AT+TRACE="))
+    {
+        int value = cmd.substring(strlen("AT+TRACE=")).toInt();
+        if (value >= LORA_BOOL_MIN && value <= LORA_BOOL_MAX)
+        {
+            traceEnabled = value;
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.println("ERR: Trace must be 0 or 1");
+        }
+    }
+    else if (cmd == "AT+TRACEDUMP" || cmd.startsWith("AT+TRACEDUMP="))
+    {
+        long baud = cmd.length() > strlen("AT+TRACEDUMP") ? cmd.substring(strlen("AT+TRACEDUMP=")).toInt() : TRACE_DUMP_BAUD;
+        if (baud >= TRACE_DUMP_BAUD_MIN && baud <= TRACE_DUMP_BAUD_MAX)
+        {
+            // Announce the dump baud rate, give the host time to follow
+            Serial.printf("BAUD,%ld\n", baud);
+            Serial.flush();
+            Serial.updateBaudRate(baud);
+            delay(200);
+            traceDump(Serial, []() { esp_task_wdt_reset(); });
+            delay(200);
+            Serial.updateBaudRate(config.modbus_baudrate);
+            Serial.println("OK");
+        }
+        else
+        {
+            Serial.printf("ERR: Baud must be between %d and %d\n", TRACE_DUMP_BAUD_MIN, TRACE_DUMP_BAUD_MAX);
+        }
+    }
+    else if (cmd == "AT+TRACECLEAR")
+    {
+        traceErase();
+        Serial.println("OK");
+    }
 
     else if (cmd == "AT+STATUS")
     {
         Serial.println("=== Device Configuration ===");
         Serial.printf("RF Frequency:           %lu Hz\n", config.rf_frequency);
         Serial.printf("TX Output Power:        %d dBm\n", config.tx_output_power);
+        Serial.printf("Modem:                  %s\n", config.fsk_enabled ? "FSK" : "LORA");
+        Serial.printf("FSK Bitrate/Fdev/RxBW:  %lu / %lu / %lu\n", config.fsk_bitrate, config.fsk_fdev,
+                      config.fsk_bandwidth);
+        Serial.printf("FSK Whitening/CRC:      %s / %s\n", config.fsk_whitening ? "ON" : "OFF",
+                      config.fsk_crc ? "ON" : "OFF");
         Serial.printf("LoRa Bandwidth:         %u\n", config.lora_bandwidth);
         Serial.printf("LoRa Spreading Factor:  %u\n", config.lora_spreading_factor);
         Serial.printf("LoRa Coding Rate:       %u\n", config.lora_codingrate);
@@ -456,9 +1565,16 @@ void handleATCommand(const String &cmd)
         Serial.printf("Fix Length Payload:     %s\n", config.lora_fix_length_payload_on ? "ON" : "OFF");
         Serial.printf("IQ Inversion:           %s\n", config.lora_iq_inversion_on ? "ON" : "OFF");
 
-        Serial.printf("LBT RSSI Threshold:     %d dBm\n", config.lbt_rssi_threshold);
+        Serial.printf("LBT RSSI Threshold:     %d dBm (in use %d dBm)\n", config.lbt_rssi_threshold, lbtThreshold());
         Serial.printf("LBT Time:               %u ms\n", config.lbt_time);
         Serial.printf("LBT Retry:              %u\n", config.lbt_retry);
+        Serial.printf("LBT Auto/Margin:        %s / %u dB\n", config.lbt_auto ? "ON" : "OFF", config.lbt_margin);
+        Serial.printf("RS485 Mode:             %s (DE pin %d)\n",
+                      config.rs485_mode == RS485_DE ? "DE/RE" : config.rs485_mode == RS485_ECHO ? "COLLISION DETECT" : "OFF",
+                      config.rs485_de_pin);
+        Serial.printf("Flow Control:           %s (RTS %d, CTS %d)\n",
+                      config.flow_mode == FLOW_RTSCTS ? "RTS/CTS" : config.flow_mode == FLOW_XONXOFF ? "XON/XOFF" : "OFF",
+                      config.flow_rts_pin, config.flow_cts_pin);
         Serial.printf("TX Timeout:             %lu ms\n", config.tx_timeout);
 
         Serial.printf("Modbus Baudrate:        %lu\n", config.modbus_baudrate);
@@ -468,10 +1584,29 @@ void handleATCommand(const String &cmd)
         Serial.printf("Debug Output:           %s\n", config.print_debug ? "ENABLED" : "DISABLED");
         Serial.printf("Beacon Mode:            %s\n", config.beaconEnabled ? "ENABLED" : "DISABLED");
         Serial.printf("Beacon Interval:        %lu ms\n", config.beaconIntervalMs);
+        Serial.printf("Delta Encoding:         %s\n", config.delta_enabled ? "ENABLED" : "DISABLED");
+        Serial.printf("Delta Resync Interval:  %u frames\n", config.delta_resync_interval);
+        Serial.printf("LZ Compression:         %s\n", config.lz_enabled ? "ENABLED" : "DISABLED");
+        Serial.printf("Routing:                %s\n", config.routing_enabled ? "ENABLED" : "DISABLED");
+        Serial.printf("Relay Address:          %u\n", config.relay_address);
+        Serial.printf("Route Protocol:         %s\n", config.route_protocol == ROUTE_PROTO_MBUS ? "M-Bus" : "Modbus");
+        Serial.printf("Mesh:                   %s\n", config.mesh_enabled ? "ENABLED" : "DISABLED");
+        Serial.printf("Mesh Max Hops:          %u\n", config.mesh_max_hops);
+        Serial.printf("Mesh Jitter:            %u ms\n", config.mesh_jitter_ms);
+        Serial.printf("TDMA Mode:              %s\n", config.tdma_mode == TDMA_MODE_HEADEND ? "HEAD-END" : config.tdma_mode == TDMA_MODE_MEMBER ? "MEMBER" : "OFF");
+        Serial.printf("TDMA Guard:             %u ms\n", config.tdma_guard_ms);
+        Serial.printf("Packet Trace:           %s\n", traceEnabled ? "ENABLED" : "DISABLED");
+        Serial.printf("Fast Boot:              %s\n", config.fast_boot ? "ENABLED" : "DISABLED");
+        Serial.printf("Sleep Period/Window:    %lu / %u ms\n", config.sleep_period_ms, config.sleep_window_ms);
+        Serial.printf("Sniff Sleep (own/peer): %u / %u ms\n", config.sniff_sleep_ms, config.peer_sniff_ms);
+        Serial.printf("Heap Limit:             %lu bytes\n", healthMinFree);
+        Serial.printf("Largest Block Limit:    %lu bytes\n", healthMinBlock);
         Serial.println("=============================");
     }
     else if (cmd == "AT+SAVE")
     {
+        // NVS stalls the UART interrupt, see uart_egress.h
+        Serial.flush();
         saveConfig();
         Serial.println("OK");
     }
@@ -483,6 +1618,8 @@ void handleATCommand(const String &cmd)
         Serial.println("AT+SETDEBUG=<0|1>");
         Serial.println("AT+SETRF=<freq Hz>");
         Serial.println("AT+SETTXPWR=<2-22>");
+        Serial.println("AT+MODEM=<LORA|FSK>");
+        Serial.println("AT+FSK=<bitrate>,<fdev>,<rxbw>[,<whitening>,<crc>]");
         Serial.println("AT+SETSF=<6-12>");
         Serial.println("AT+SETBW=<0-2>");
         Serial.println("AT+SETCR=<1-4>");
@@ -499,6 +1636,48 @@ void handleATCommand(const String &cmd)
         Serial.println("AT+SETTIMEOUT=<ms>");
         Serial.println("AT+BEACON=<0|1>");
         Serial.println("AT+SETBEACONINT=<ms>");
+        Serial.println("AT+DELTA=<0|1>");
+        Serial.println("AT+SETDELTARESYNC=<1-255>");
+        Serial.println("AT+DELTASTATS");
+        Serial.println("AT+LZ=<0|1>");
+        Serial.println("AT+LZSTATS");
+        Serial.println("AT+ROUTING=<0|1>");
+        Serial.println("AT+SETADDR=<0-254>");
+        Serial.println("AT+SETROUTEPROTO=<0|1>");
+        Serial.println("AT+ROUTE=<slave>,<relay>");
+        Serial.println("AT+OWN=<slave>,<0|1>");
+        Serial.println("AT+ROUTES");
+        Serial.println("AT+MESH=<0|1>");
+        Serial.println("AT+SETMESHHOPS=<1-15>");
+        Serial.println("AT+SETMESHJITTER=<0-5000>");
+        Serial.println("AT+MESHROUTES");
+        Serial.println("AT+TDMA=<0|1|2>");
+        Serial.println("AT+TDMASLOT=<idx>,<relay>,<bytes>");
+        Serial.println("AT+SETTDMAGUARD=<ms>");
+        Serial.println("AT+TDMASTATS");
+        Serial.println("AT+LATENCY");
+        Serial.println("AT+LATENCY=RESET");
+        Serial.println("AT+STATS");
+        Serial.println("AT+STATS=RESET");
+        Serial.println("AT+HEALTH");
+        Serial.println("AT+SETHEAPMIN=<bytes>");
+        Serial.println("AT+SETBLOCKMIN=<bytes>");
+        Serial.println("AT+FASTBOOT=<0|1>");
+        Serial.println("AT+BOOTTIME");
+        Serial.println("AT+SLEEPSCHED=<period>,<window>");
+        Serial.println("AT+SLEEPSTATS");
+        Serial.println("AT+SNIFF=<ms>");
+        Serial.println("AT+PEERSNIFF=<ms>");
+        Serial.println("AT+SNIFFINFO");
+        Serial.println("AT+RS485=<0|1|2>[,<DE pin>]");
+        Serial.println("AT+FLOW=<0|1|2>[,<RTS pin>,<CTS pin>]");
+        Serial.println("AT+LBTAUTO=<0|1>[,<margin dB>]");
+        Serial.println("AT+NOISE");
+        Serial.println("AT+SCAN[=<dwell ms>[,<step kHz>]]");
+        Serial.println("AT+CHANNEL=<freq|BEST>");
+        Serial.println("AT+TRACE=<0|1>");
+        Serial.println("AT+TRACEDUMP[=<baud>]");
+        Serial.println("AT+TRACECLEAR");
         Serial.println("AT+SAVE");
         Serial.println("AT+STATUS");
         Serial.println("OK");
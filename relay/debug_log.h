@@ -0,0 +1,219 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include "Arduino.h"
+#include "settings.h"
+#include "command_parser.h"
+
+/*
+ * Deferred debug log
+ *
+ * printfDebug() does not format anything. It stores the time, the format
+ * string pointer (the literal stays in flash, so the pointer is its ID) and
+ * up to DEBUG_LOG_ARGS 32-bit arguments in a single-producer ring and returns.
+ * A low priority task renders the records to DEBUG_LOG_SERIAL once the serial
+ * bus has been quiet for config.modbus_read_delay. Bus writers in loop()
+ * (received frames, beacons, AT replies) and the task share one lock, taken
+ * with debugLogBusTake(); the task re-checks the bus under it for every
+ * record, so log text never lands in the middle of a bus frame.
+ *
+ * Arguments are stored by value: %s must point to a string that outlives the
+ * record (a literal). Buffers are logged with printHex() or printTextDebug(),
+ * which copy up to DEBUG_LOG_TEXT bytes per record. When the ring is full new records are
+ * dropped and counted.
+ */
+
+#define DEBUG_LOG_ARGS 4
+#define DEBUG_LOG_TEXT (DEBUG_LOG_ARGS * 4)
+
+typedef struct
+{
+    uint32_t ms;
+    const char *fmt;
+    uint8_t textLen; // 0: args hold printf arguments, else args hold textLen raw bytes
+    bool more;       // buffer continues in the next record
+    bool ascii;      // render the buffer as text instead of hex
+    union
+    {
+        uint32_t args[DEBUG_LOG_ARGS];
+        uint8_t text[DEBUG_LOG_TEXT];
+    };
+} debug_log_record_t;
+
+static debug_log_record_t debugLogRing[DEBUG_LOG_RECORDS];
+static std::atomic<uint16_t> debugLogHead(0); // written by the producer (loop)
+static std::atomic<uint16_t> debugLogTail(0); // written by the log task
+static volatile uint32_t debugLogDropped = 0;
+static volatile unsigned long debugLogBusActivity = 0;
+static SemaphoreHandle_t debugLogBusMutex = NULL;
+
+// Claims the next free record, NULL when the ring is full
+static debug_log_record_t *debugLogClaim(const char *fmt)
+{
+    uint16_t head = debugLogHead.load(std::memory_order_relaxed);
+    uint16_t next = (head + 1) % DEBUG_LOG_RECORDS;
+    if (next == debugLogTail.load(std::memory_order_acquire))
+    {
+        debugLogDropped++;
+        return NULL;
+    }
+    debug_log_record_t *r = &debugLogRing[head];
+    r->ms = millis();
+    r->fmt = fmt;
+    return r;
+}
+
+static void debugLogPublish()
+{
+    uint16_t head = debugLogHead.load(std::memory_order_relaxed);
+    debugLogHead.store((head + 1) % DEBUG_LOG_RECORDS, std::memory_order_release);
+}
+
+template <typename T>
+static inline uint32_t debugLogArg(T value)
+{
+    return (uint32_t)value;
+}
+
+template <typename T>
+static inline uint32_t debugLogArg(T *value)
+{
+    return (uint32_t)(uintptr_t)value;
+}
+
+template <typename... Args>
+void printfDebug(const char *fmt, Args... args)
+{
+    static_assert(sizeof...(Args) <= DEBUG_LOG_ARGS, "too many printfDebug arguments");
+    if (!config.print_debug)
+        return;
+    debug_log_record_t *r = debugLogClaim(fmt);
+    if (!r)
+        return;
+    uint32_t values[DEBUG_LOG_ARGS + 1] = {debugLogArg(args)...};
+    memcpy(r->args, values, sizeof(r->args));
+    r->textLen = 0;
+    debugLogPublish();
+}
+
+// Logs `label` followed by a copy of data, split over as many records as needed
+static void debugLogBuffer(const char *label, const uint8_t *data, size_t len, bool ascii)
+{
+    if (!config.print_debug)
+        return;
+    for (size_t off = 0; off < len; off += DEBUG_LOG_TEXT)
+    {
+        debug_log_record_t *r = debugLogClaim(off == 0 ? label : NULL);
+        if (!r)
+            return;
+        size_t n = len - off < DEBUG_LOG_TEXT ? len - off : DEBUG_LOG_TEXT;
+        memcpy(r->text, data + off, n);
+        r->textLen = n;
+        r->more = off + n < len;
+        r->ascii = ascii;
+        debugLogPublish();
+    }
+}
+
+void printHex(const char *label, const uint8_t *data, size_t len)
+{
+    debugLogBuffer(label, data, len, false);
+}
+
+void printTextDebug(const char *label, const char *text, size_t len)
+{
+    debugLogBuffer(label, (const uint8_t *)text, len, true);
+}
+
+// Called by the data path whenever the serial bus carries a frame
+void debugLogBusBusy()
+{
+    debugLogBusActivity = millis();
+}
+
+// Takes the serial port for bus output. Waits at most for the log record
+// being rendered, then keeps the task off the port until the bus is quiet.
+void debugLogBusTake()
+{
+    if (debugLogBusMutex)
+        xSemaphoreTake(debugLogBusMutex, portMAX_DELAY);
+    debugLogBusActivity = millis();
+}
+
+void debugLogBusGive()
+{
+    if (debugLogBusMutex)
+        xSemaphoreGive(debugLogBusMutex);
+}
+
+static bool debugLogBusIdle()
+{
+    return Serial.available() == 0 && millis() - debugLogBusActivity >= config.modbus_read_delay;
+}
+
+// Returns the bytes written, for the RS485 echo count
+static size_t debugLogRender(const debug_log_record_t &r)
+{
+    size_t n = 0;
+    if (r.textLen == 0)
+    {
+        n += DEBUG_LOG_SERIAL.printf("[%lu] ", r.ms);
+        n += DEBUG_LOG_SERIAL.printf(r.fmt, r.args[0], r.args[1], r.args[2], r.args[3]);
+        return n;
+    }
+    // Continuation records carry no label
+    if (r.fmt)
+        n += DEBUG_LOG_SERIAL.printf("[%lu] %s", r.ms, r.fmt);
+    if (r.ascii)
+        n += DEBUG_LOG_SERIAL.write(r.text, r.textLen);
+    else
+        for (uint8_t i = 0; i < r.textLen; i++)
+            n += DEBUG_LOG_SERIAL.printf("%02X ", r.text[i]);
+    if (!r.more)
+        n += DEBUG_LOG_SERIAL.println();
+    return n;
+}
+
+// Log output on the bus comes back in RS485 collision detect mode
+static void debugLogEcho(size_t n)
+{
+    const Print *out = &DEBUG_LOG_SERIAL;
+    if (out == &Serial)
+        egressEchoExpect(n);
+}
+
+static void debugLogTask(void *)
+{
+    uint32_t reportedDrops = 0;
+    for (;;)
+    {
+        vTaskDelay(pdMS_TO_TICKS(DEBUG_LOG_POLL_MS));
+        for (;;)
+        {
+            xSemaphoreTake(debugLogBusMutex, portMAX_DELAY);
+            uint16_t tail = debugLogTail.load(std::memory_order_relaxed);
+            if (!debugLogBusIdle() || tail == debugLogHead.load(std::memory_order_acquire))
+            {
+                xSemaphoreGive(debugLogBusMutex);
+                break;
+            }
+            debugLogEcho(debugLogRender(debugLogRing[tail]));
+            debugLogTail.store((tail + 1) % DEBUG_LOG_RECORDS, std::memory_order_release);
+            xSemaphoreGive(debugLogBusMutex);
+        }
+        xSemaphoreTake(debugLogBusMutex, portMAX_DELAY);
+        if (debugLogDropped != reportedDrops && debugLogBusIdle())
+        {
+            reportedDrops = debugLogDropped;
+            debugLogEcho(DEBUG_LOG_SERIAL.printf("[LOG] %lu records dropped\n", reportedDrops));
+        }
+        xSemaphoreGive(debugLogBusMutex);
+    }
+}
+
+void debugLogBegin()
+{
+    debugLogBusMutex = xSemaphoreCreateMutex();
+    xTaskCreate(debugLogTask, "debug_log", DEBUG_LOG_STACK, NULL, DEBUG_LOG_PRIORITY, NULL);
+}
@@ -0,0 +1,318 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "settings.h"
+
+/*
+ * Delta encoding of periodic payloads
+ *
+ * Meters answer the same poll with frames that differ in only a few bytes.
+ * Each outgoing frame is matched to a slot by its key (first two bytes and
+ * length, i.e. slave address + function code for Modbus RTU, start + L field
+ * for M-Bus) and, when the slot holds a reference, sent as the XOR against
+ * that reference, run-length coded:
+ *
+ *   0x00..0x7F  literal run of (t + 1) XORed bytes follows
+ *   0x80..0xFF  (t & 0x7F) + 1 unchanged bytes
+ *
+ * Every frame carries the slot and a per-slot sequence number. The receiver
+ * only applies a delta on top of sequence (seq - 1); anything else is dropped
+ * and a resync is requested so the next frame on that slot goes out in full.
+ * A full frame is also forced every `resyncInterval` frames per slot.
+ *
+ * With routing several relays may send deltas to us, each numbering its
+ * own slots, so the RX references are kept per source relay: DELTA_RX_PEERS
+ * sets of DELTA_SLOTS, the least recently heard source giving way to a new
+ * one. Without routing every frame comes from the one peer.
+ *
+ * Both tables are fixed size, reconstruction happens directly into the
+ * caller's buffer and the slot reference, so RAM use does not depend on traffic.
+ */
+
+#define DELTA_HDR_SIZE 2 // [slot][seq]
+
+#define DELTA_RLE_ZERO 0x80
+#define DELTA_RLE_MAX_RUN 128
+
+typedef struct
+{
+    bool valid;
+    uint8_t key0;
+    uint8_t key1;
+    uint8_t len;
+    uint8_t seq;
+    uint8_t sinceFull;
+    uint32_t lastUsed;
+    uint8_t data[LORA_BUFFER];
+} delta_slot_t;
+
+typedef struct
+{
+    uint32_t txRawBytes;
+    uint32_t txAirBytes;
+    uint32_t txFull;
+    uint32_t txDelta;
+    uint32_t rxAirBytes;
+    uint32_t rxRawBytes;
+    uint32_t rxFull;
+    uint32_t rxDelta;
+    uint32_t rxDropped;
+    uint32_t resyncRequests;
+} delta_stats_t;
+
+static delta_slot_t deltaTx[DELTA_SLOTS];
+static delta_slot_t deltaRx[DELTA_RX_PEERS][DELTA_SLOTS];
+static uint8_t deltaRxSrc[DELTA_RX_PEERS];
+static uint32_t deltaRxUsed[DELTA_RX_PEERS]; // 0: set unused
+static delta_stats_t deltaStats;
+static uint32_t deltaUseCounter = 0;
+
+// Staged TX update, committed only once the frame has actually been sent
+static int8_t deltaPendingSlot = -1;
+static uint8_t deltaPendingLen = 0;
+static uint8_t deltaPendingFull = 0;
+static uint16_t deltaPendingAir = 0;
+
+static size_t deltaRleEncode(const uint8_t *cur, const uint8_t *ref, size_t len, uint8_t *out, size_t outMax)
+{
+    size_t i = 0;
+    size_t o = 0;
+    while (i < len)
+    {
+        size_t run = 0;
+        while (i + run < len && run < DELTA_RLE_MAX_RUN && cur[i + run] == ref[i + run])
+            run++;
+        if (run > 0)
+        {
+            if (o + 1 > outMax)
+                return 0;
+            out[o++] = DELTA_RLE_ZERO | (uint8_t)(run - 1);
+            i += run;
+            continue;
+        }
+
+        // Literal run ends at the first pair of unchanged bytes, a single
+        // unchanged byte is cheaper to carry than a token switch
+        size_t start = i;
+        while (i < len && i - start < DELTA_RLE_MAX_RUN)
+        {
+            if (cur[i] == ref[i] && (i + 1 >= len || cur[i + 1] == ref[i + 1]))
+                break;
+            i++;
+        }
+        size_t lit = i - start;
+        if (o + 1 + lit > outMax)
+            return 0;
+        out[o++] = (uint8_t)(lit - 1);
+        for (size_t k = 0; k < lit; k++)
+            out[o++] = cur[start + k] ^ ref[start + k];
+    }
+    return o;
+}
+
+// Applies an RLE body on top of ref, returns false on malformed input
+static bool deltaRleDecode(const uint8_t *in, size_t inLen, const uint8_t *ref, size_t len, uint8_t *out)
+{
+    size_t i = 0;
+    size_t o = 0;
+    while (i < inLen)
+    {
+        uint8_t t = in[i++];
+        size_t run = (t & 0x7F) + 1;
+        if (o + run > len)
+            return false;
+        if (t & DELTA_RLE_ZERO)
+        {
+            memcpy(out + o, ref + o, run);
+        }
+        else
+        {
+            if (i + run > inLen)
+                return false;
+            for (size_t k = 0; k < run; k++)
+                out[o + k] = ref[o + k] ^ in[i + k];
+            i += run;
+        }
+        o += run;
+    }
+    return o == len;
+}
+
+static int deltaFindTxSlot(const uint8_t *data, size_t len)
+{
+    int victim = 0;
+    for (int s = 0; s < DELTA_SLOTS; s++)
+    {
+        delta_slot_t &slot = deltaTx[s];
+        if (slot.valid && slot.len == len && slot.key0 == data[0] && slot.key1 == data[1])
+            return s;
+        if (!slot.valid)
+            victim = s;
+        else if (deltaTx[victim].valid && slot.lastUsed < deltaTx[victim].lastUsed)
+            victim = s;
+    }
+    return victim;
+}
+
+/*
+ * Encodes len bytes into out as [slot][seq][body], body being either the raw
+ * frame or the RLE delta. Sets *isDelta accordingly. The TX table is only
+ * updated by deltaCommitTx() once the frame went out.
+ */
+size_t deltaEncode(const uint8_t *data, size_t len, uint8_t *out, size_t outMax, uint8_t resyncInterval, bool *isDelta)
+{
+    *isDelta = false;
+    deltaPendingSlot = -1;
+    if (len < 2 || len > LORA_BUFFER || outMax < DELTA_HDR_SIZE + len)
+        return 0;
+
+    int s = deltaFindTxSlot(data, len);
+    delta_slot_t &slot = deltaTx[s];
+    bool match = slot.valid && slot.len == len && slot.key0 == data[0] && slot.key1 == data[1];
+    uint8_t seq = match ? (uint8_t)(slot.seq + 1) : 0;
+
+    out[0] = (uint8_t)s;
+    out[1] = seq;
+
+    size_t body = 0;
+    if (match && slot.sinceFull + 1 < resyncInterval)
+    {
+        body = deltaRleEncode(data, slot.data, len, out + DELTA_HDR_SIZE, len - 1);
+    }
+    if (body > 0)
+    {
+        *isDelta = true;
+    }
+    else
+    {
+        memcpy(out + DELTA_HDR_SIZE, data, len);
+        body = len;
+    }
+
+    deltaPendingSlot = s;
+    deltaPendingLen = len;
+    deltaPendingFull = !*isDelta;
+    deltaPendingAir = DELTA_HDR_SIZE + body;
+    return DELTA_HDR_SIZE + body;
+}
+
+// Makes the frame staged by the last deltaEncode() the new slot reference and
+// counts it; frames that never made it on air stay out of the stats
+void deltaCommitTx(const uint8_t *data)
+{
+    if (deltaPendingSlot < 0)
+        return;
+    deltaStats.txRawBytes += deltaPendingLen;
+    deltaStats.txAirBytes += deltaPendingAir;
+    if (deltaPendingFull)
+        deltaStats.txFull++;
+    else
+        deltaStats.txDelta++;
+    delta_slot_t &slot = deltaTx[deltaPendingSlot];
+    bool match = slot.valid && slot.len == deltaPendingLen && slot.key0 == data[0] && slot.key1 == data[1];
+    slot.seq = match ? (uint8_t)(slot.seq + 1) : 0;
+    slot.sinceFull = deltaPendingFull ? 0 : slot.sinceFull + 1;
+    slot.valid = true;
+    slot.key0 = data[0];
+    slot.key1 = data[1];
+    slot.len = deltaPendingLen;
+    slot.lastUsed = ++deltaUseCounter;
+    memcpy(slot.data, data, deltaPendingLen);
+    deltaPendingSlot = -1;
+}
+
+void deltaInvalidateTx(uint8_t slot)
+{
+    if (slot < DELTA_SLOTS)
+        deltaTx[slot].valid = false;
+}
+
+// Reference set of source relay `src`, a new source takes the least recently used one
+static delta_slot_t *deltaRxPeer(uint8_t src)
+{
+    int victim = 0;
+    for (int p = 0; p < DELTA_RX_PEERS; p++)
+    {
+        if (deltaRxUsed[p] && deltaRxSrc[p] == src)
+        {
+            deltaRxUsed[p] = ++deltaUseCounter;
+            return deltaRx[p];
+        }
+        if (deltaRxUsed[p] < deltaRxUsed[victim])
+            victim = p;
+    }
+    memset(deltaRx[victim], 0, sizeof(deltaRx[victim]));
+    deltaRxSrc[victim] = src;
+    deltaRxUsed[victim] = ++deltaUseCounter;
+    return deltaRx[victim];
+}
+
+/*
+ * Reconstructs a [slot][seq][body] frame from relay `src` into out. Returns the payload length,
+ * or -1 when the frame must be dropped; *resyncSlot is then set to the slot
+ * the peer should resend in full (or -1 for malformed frames).
+ */
+int deltaDecode(uint8_t src, const uint8_t *in, size_t len, bool isDelta, uint8_t *out, int *resyncSlot)
+{
+    *resyncSlot = -1;
+    if (len < DELTA_HDR_SIZE || in[0] >= DELTA_SLOTS)
+    {
+        deltaStats.rxDropped++;
+        return -1;
+    }
+
+    delta_slot_t &slot = deltaRxPeer(src)[in[0]];
+    uint8_t seq = in[1];
+    const uint8_t *body = in + DELTA_HDR_SIZE;
+    size_t bodyLen = len - DELTA_HDR_SIZE;
+    deltaStats.rxAirBytes += len;
+
+    if (!isDelta)
+    {
+        if (bodyLen > LORA_BUFFER)
+        {
+            deltaStats.rxDropped++;
+            return -1;
+        }
+        memcpy(slot.data, body, bodyLen);
+        memcpy(out, body, bodyLen);
+        slot.len = bodyLen;
+    }
+    else
+    {
+        if (!slot.valid || seq != (uint8_t)(slot.seq + 1) ||
+            !deltaRleDecode(body, bodyLen, slot.data, slot.len, out))
+        {
+            slot.valid = false;
+            deltaStats.rxDropped++;
+            deltaStats.resyncRequests++;
+            *resyncSlot = in[0];
+            return -1;
+        }
+        memcpy(slot.data, out, slot.len);
+    }
+
+    slot.valid = true;
+    slot.seq = seq;
+    deltaStats.rxRawBytes += slot.len;
+    if (isDelta)
+        deltaStats.rxDelta++;
+    else
+        deltaStats.rxFull++;
+    return slot.len;
+}
+
+void deltaReset()
+{
+    memset(deltaTx, 0, sizeof(deltaTx));
+    memset(deltaRx, 0, sizeof(deltaRx));
+    memset(deltaRxUsed, 0, sizeof(deltaRxUsed));
+    memset(&deltaStats, 0, sizeof(deltaStats));
+    deltaPendingSlot = -1;
+}
+
+// Compression ratio as raw/air in hundredths, 100 means no gain
+uint32_t deltaRatio(uint32_t raw, uint32_t air)
+{
+    return air ? (raw * 100UL) / air : 100;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <stdint.h>
+#include "Arduino.h"
+#include "driver/uart.h"
+#include "settings.h"
+
+/*
+ * Serial back-pressure
+ *
+ * Bytes from the host wait in the UART RX ring (UART_RX_BUFFER_SIZE) until
+ * they go on the air. The driver's interrupt moves them there from the
+ * 128 byte hardware FIFO; once the ring has no room it stops doing so and
+ * the FIFO fills. Both modes are run by the UART itself from the FIFO
+ * level, so holding the host off does not depend on how long loop() is
+ * busy:
+ *
+ * - FLOW_RTSCTS: RTS goes inactive at FLOW_RTS_THRESHOLD bytes in the FIFO,
+ *   the rest of the FIFO takes what the host still sends. CTS from the host
+ *   pauses our output.
+ * - FLOW_XONXOFF: XOFF at FLOW_XOFF_THRESHOLD, XON again at
+ *   FLOW_XON_THRESHOLD. XON/XOFF from the host pause our output and are
+ *   removed from the data, so this is for text only.
+ *
+ * RTS/CTS cannot be used with hardware RS485, which takes RTS for DE/RE.
+ */
+
+#define FLOW_OFF 0
+#define FLOW_RTSCTS 1
+#define FLOW_XONXOFF 2
+#define FLOW_FIFO_SIZE 128 // UART RX FIFO in front of the ring
+
+typedef struct
+{
+    uint32_t stops; // times the ring filled up and the UART held the host off
+    uint32_t maxBacklog;
+} flow_stats_t;
+
+static flow_stats_t flowStats;
+static uint8_t flowMode = FLOW_OFF;
+static bool flowStopped = false;
+
+bool flowApply(uint8_t mode, int8_t rtsPin, int8_t ctsPin)
+{
+    flowMode = FLOW_OFF;
+    flowStopped = false;
+    uart_set_sw_flow_ctrl(SERIAL_UART_NUM, false, 0, 0);
+    Serial.setHwFlowCtrlMode(UART_HW_FLOWCTRL_DISABLE);
+    if (mode == FLOW_RTSCTS &&
+        (rtsPin < 0 || ctsPin < 0 || !Serial.setPins(-1, -1, ctsPin, rtsPin) ||
+         !Serial.setHwFlowCtrlMode(UART_HW_FLOWCTRL_CTS_RTS, FLOW_RTS_THRESHOLD)))
+        return false;
+    if (mode == FLOW_XONXOFF &&
+        uart_set_sw_flow_ctrl(SERIAL_UART_NUM, true, FLOW_XON_THRESHOLD, FLOW_XOFF_THRESHOLD) != ESP_OK)
+        return false;
+    flowMode = mode;
+    return true;
+}
+
+// Statistics only, call every loop with the bytes waiting for the air. The
+// ring counts as full once it cannot take another FIFO load.
+void flowService(size_t backlog)
+{
+    if (backlog > flowStats.maxBacklog)
+        flowStats.maxBacklog = backlog;
+    if (flowMode == FLOW_OFF)
+        return;
+    if (!flowStopped && backlog + FLOW_FIFO_SIZE > UART_RX_BUFFER_SIZE)
+    {
+        flowStats.stops++;
+        flowStopped = true;
+    }
+    else if (flowStopped && backlog <= UART_RX_BUFFER_SIZE / 2)
+    {
+        flowStopped = false;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <stdint.h>
+#include "Arduino.h"
+#include "esp_heap_caps.h"
+#include "settings.h"
+
+/*
+ * Heap and stack health
+ *
+ * Replaces the fixed interval reboot. Once per HEALTH_CHECK_MS the free heap,
+ * the largest free block and the loop task's stack high water mark are
+ * compared with their limits. Only when a limit stays crossed for
+ * HEALTH_TRIP_CHECKS checks in a row does healthCheck() ask for a restart.
+ * A limit of 0 disables that check.
+ *
+ * Fragmentation is reported as the share of free heap that is not part of
+ * the largest free block, in percent.
+ */
+
+typedef struct
+{
+    uint32_t freeBytes;
+    uint32_t minFreeBytes; // low water mark since boot
+    uint32_t largestBlock;
+    uint32_t allocatedBlocks;
+    uint32_t freeBlocks;
+    uint32_t stackFree; // loop task, bytes never used
+    uint8_t fragmentation;
+} health_sample_t;
+
+static health_sample_t healthLast;
+static uint32_t healthMinFree = HEALTH_MIN_FREE_HEAP;
+static uint32_t healthMinBlock = HEALTH_MIN_LARGEST_BLOCK;
+static volatile uint32_t healthFailedAllocs = 0;
+static uint8_t healthTrips = 0;
+static unsigned long healthLastCheck = 0;
+
+static void healthOnAllocFailed(size_t, uint32_t, const char *)
+{
+    healthFailedAllocs++;
+}
+
+void healthBegin()
+{
+    heap_caps_register_failed_alloc_callback(healthOnAllocFailed);
+}
+
+void healthSample(health_sample_t *s)
+{
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+    s->freeBytes = info.total_free_bytes;
+    s->minFreeBytes = info.minimum_free_bytes;
+    s->largestBlock = info.largest_free_block;
+    s->allocatedBlocks = info.allocated_blocks;
+    s->freeBlocks = info.free_blocks;
+    s->stackFree = uxTaskGetStackHighWaterMark(NULL);
+    s->fragmentation = s->freeBytes ? 100 - (uint64_t)s->largestBlock * 100 / s->freeBytes : 0;
+}
+
+// Returns true when the relay should restart
+bool healthCheck(unsigned long now)
+{
+    if (now - healthLastCheck < HEALTH_CHECK_MS)
+        return false;
+    healthLastCheck = now;
+    healthSample(&healthLast);
+
+    bool unhealthy = (healthMinFree && healthLast.freeBytes < healthMinFree) ||
+                     (healthMinBlock && healthLast.largestBlock < healthMinBlock) ||
+                     healthLast.stackFree < HEALTH_MIN_STACK;
+    healthTrips = unhealthy ? healthTrips + 1 : 0;
+    return healthTrips >= HEALTH_TRIP_CHECKS;
+}
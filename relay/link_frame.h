@@ -0,0 +1,441 @@
+#pragma once
+#include "Arduino.h"
+#include "settings.h"
+#include "command_parser.h"
+#include "delta_codec.h"
+#include "lz_codec.h"
+#include "routing.h"
+#include "mesh.h"
+#include "tdma.h"
+#include "timestamps.h"
+#include "channel_scan.h"
+
+/*
+ * On-air link framing
+ *
+ * With every encoding stage disabled frames go out exactly as read from the
+ * serial port. Once a stage is enabled, each frame starts with a flags byte
+ * describing how the rest of it was encoded:
+ *
+ *   [flags][stage headers...][body]
+ *
+ * With routing enabled the routing header (see routing.h), followed by the
+ * mesh header when multi-hop is on (see mesh.h), goes in front of everything
+ * else so receivers can filter on it before reading the rest.
+ * Both relays of a link must run the same stage configuration.
+ */
+
+#define LINK_FLAG_RAW 0x00
+#define LINK_FLAG_DELTA_FULL 0x01
+#define LINK_FLAG_DELTA 0x02
+#define LINK_FLAG_LZ 0x04
+#define LINK_FLAG_CTRL 0x80
+
+#define LINK_CTRL_RESYNC 0x01
+#define LINK_CTRL_TDMA_BEACON 0x02
+#define LINK_CTRL_CHANNEL 0x03 // [freq Hz:4][GFSK:1], older relays send no modem byte
+#define LINK_CTRL_SNIFF 0x04   // [sleep ms:2] sender's sniff period
+#define LINK_CTRL_PROBE 0x05   // [freq Hz:4][heard a peer:1] after a channel change
+
+#define LINK_HDR_SIZE 1
+
+#define LINK_RESYNC_MAX 8
+
+// Resync requests to send, per source relay and slot, oldest first. Sent as
+// control frames from loop(); a request that does not fit is dropped, the
+// sender's periodic full frame recovers that slot.
+typedef struct
+{
+    uint8_t src;
+    uint8_t slot;
+} link_resync_t;
+
+static link_resync_t linkResync[LINK_RESYNC_MAX];
+static uint8_t linkResyncCount = 0;
+// The first request was built into a frame, dropped from the list once sent
+static bool linkCtrlBuilt = false;
+
+static void linkQueueResync(uint8_t src, uint8_t slot)
+{
+    for (uint8_t i = 0; i < linkResyncCount; i++)
+        if (linkResync[i].src == src && linkResync[i].slot == slot)
+            return;
+    if (linkResyncCount < LINK_RESYNC_MAX)
+        linkResync[linkResyncCount++] = {src, slot};
+}
+
+// A mesh header was built with meshPeekSeq(), taken by linkCommitHeaders()
+static bool linkSeqPending = false;
+
+// Intermediate buffer between the delta and compression stages
+static uint8_t linkScratch[LORA_BUFFER];
+
+// Estimated start of the frame being decoded, for beacon time sync
+static unsigned long linkRxStart = 0;
+
+bool linkFramingEnabled()
+{
+    return config.delta_enabled || config.lz_enabled || config.tdma_mode != TDMA_MODE_OFF;
+}
+
+// Largest serial frame that still fits LORA_BUFFER after link headers
+size_t linkMaxPayload()
+{
+    size_t overhead = 0;
+    if (config.routing_enabled)
+        overhead += ROUTE_HDR_SIZE;
+    if (config.mesh_enabled)
+        overhead += MESH_HDR_SIZE;
+    if (linkFramingEnabled())
+        overhead += LINK_HDR_SIZE;
+    if (config.delta_enabled)
+        overhead += DELTA_HDR_SIZE;
+    return LORA_BUFFER - 1 - overhead;
+}
+
+static size_t linkEncodeBody(const uint8_t *data, size_t len, uint8_t *out, size_t outMax, bool allowDelta)
+{
+    if (!linkFramingEnabled())
+    {
+        memcpy(out, data, len);
+        return len;
+    }
+
+    uint8_t flags = LINK_FLAG_RAW;
+    uint8_t *body = out + LINK_HDR_SIZE;
+    size_t bodyMax = outMax - LINK_HDR_SIZE;
+    size_t bodyLen = 0;
+
+    if (config.delta_enabled && allowDelta)
+    {
+        bool isDelta = false;
+        bodyLen = deltaEncode(data, len, body, bodyMax, config.delta_resync_interval, &isDelta);
+        if (bodyLen > 0)
+            flags = isDelta ? LINK_FLAG_DELTA : LINK_FLAG_DELTA_FULL;
+    }
+    if (bodyLen == 0)
+    {
+        bodyLen = min(len, bodyMax);
+        memcpy(body, data, bodyLen);
+    }
+
+    if (config.lz_enabled)
+    {
+        lzStats.txInBytes += bodyLen;
+        size_t n = lzCompress(body, bodyLen, linkScratch, bodyMax);
+        if (n > 0)
+        {
+            memcpy(body, linkScratch, n);
+            bodyLen = n;
+            flags |= LINK_FLAG_LZ;
+            lzStats.txCompressed++;
+        }
+        else
+        {
+            lzStats.txRaw++;
+        }
+        lzStats.txOutBytes += bodyLen;
+    }
+
+    out[0] = flags;
+    return LINK_HDR_SIZE + bodyLen;
+}
+
+// Writes the routing and mesh headers for a frame bound to relay `dest`
+static size_t linkWriteHeaders(uint8_t *out, uint8_t dest)
+{
+    if (!config.routing_enabled)
+        return 0;
+    if (!config.mesh_enabled)
+    {
+        out[0] = dest;
+        out[1] = config.relay_address;
+        return ROUTE_HDR_SIZE;
+    }
+
+    mesh_header_t hdr = {config.relay_address, dest, meshPeekSeq(), 0, config.mesh_max_hops};
+    out[0] = dest == ROUTE_BROADCAST ? ROUTE_BROADCAST : meshNextHop(dest, ROUTE_BROADCAST, millis());
+    out[1] = config.relay_address;
+    meshWriteHeader(out + ROUTE_HDR_SIZE, hdr);
+    linkSeqPending = true;
+    return ROUTE_HDR_SIZE + MESH_HDR_SIZE;
+}
+
+/*
+ * Call once the frame built last has been handed to the radio, or is held
+ * for it (other frames built meanwhile must not reuse its number). The mesh
+ * sequence number is only taken here, so frames rebuilt while they wait for
+ * a free channel or our slot do not burn numbers or fill the duplicate cache.
+ */
+void linkCommitHeaders()
+{
+    if (!linkSeqPending)
+        return;
+    linkSeqPending = false;
+    uint8_t seq = meshNextSeq();
+    // Our own frames coming back from neighbours are dropped as duplicates
+    meshIsDuplicate(config.relay_address, seq);
+}
+
+/*
+ * Encodes a serial frame for the air. When allowDelta is false (beacons and
+ * other one-off frames) the delta stage is skipped and the frame is
+ * broadcast. Compression is applied last and only kept when it makes the
+ * frame smaller.
+ */
+size_t linkEncode(const uint8_t *data, size_t len, uint8_t *out, bool allowDelta = true)
+{
+    uint8_t dest = allowDelta && config.routing_enabled ? routeDestination(data, len, config.route_protocol) : ROUTE_BROADCAST;
+    size_t hdrLen = linkWriteHeaders(out, dest);
+    return hdrLen + linkEncodeBody(data, len, out + hdrLen, LORA_BUFFER - hdrLen, allowDelta);
+}
+
+// Call once the frame produced by linkEncode() has been handed to the radio
+void linkCommitTx(const uint8_t *data)
+{
+    if (config.delta_enabled)
+        deltaCommitTx(data);
+}
+
+static void linkHandleCtrl(const uint8_t *in, size_t len)
+{
+    if (len >= 3 && in[1] == LINK_CTRL_RESYNC)
+    {
+        deltaInvalidateTx(in[2]);
+    }
+    else if (len >= 2 && in[1] == LINK_CTRL_TDMA_BEACON && config.tdma_mode == TDMA_MODE_MEMBER)
+    {
+        tdmaOnBeacon(in + 2, len - 2, linkRxStart);
+    }
+    else if (len >= 6 && in[1] == LINK_CTRL_CHANNEL)
+    {
+        uint32_t freq = in[2] | (in[3] << 8) | (in[4] << 16) | ((uint32_t)in[5] << 24);
+        bool fsk = len >= 7 ? in[6] != 0 : config.fsk_enabled;
+        // Sniff mode is LoRa only: stay, the sender falls back on its own
+        bool sniff = config.sniff_sleep_ms > 0 || config.peer_sniff_ms > 0;
+        if (freq >= SCAN_FREQ_MIN && freq <= SCAN_FREQ_MAX &&
+            (freq != config.rf_frequency || fsk != config.fsk_enabled) && !(fsk && sniff) && !scanSwitchBusy())
+        {
+            scanPendingFreq = freq;
+            scanPendingFsk = fsk;
+        }
+    }
+    else if (len >= 7 && in[1] == LINK_CTRL_PROBE)
+    {
+        scanOnProbe(in[6] != 0);
+    }
+    else if (len >= 4 && in[1] == LINK_CTRL_SNIFF)
+    {
+        uint16_t ms = in[2] | (in[3] << 8);
+        if (ms <= SNIFF_SLEEP_MAX && ms != config.peer_sniff_ms && !config.fsk_enabled)
+            sniffPeerPendingMs = ms;
+    }
+}
+
+// `src` is the relay that encoded the frame, ROUTE_BROADCAST without routing
+static int linkDecodeBody(const uint8_t *in, size_t len, uint8_t *out, uint8_t src)
+{
+    if (!linkFramingEnabled())
+    {
+        memcpy(out, in, len);
+        return len;
+    }
+    if (len < LINK_HDR_SIZE)
+        return -1;
+
+    uint8_t flags = in[0];
+    if (flags & LINK_FLAG_CTRL)
+    {
+        linkHandleCtrl(in, len);
+        return -1;
+    }
+
+    const uint8_t *body = in + LINK_HDR_SIZE;
+    size_t bodyLen = len - LINK_HDR_SIZE;
+    if (flags & LINK_FLAG_LZ)
+    {
+        int n = lzDecompress(body, bodyLen, linkScratch, LORA_BUFFER);
+        if (n < 0)
+        {
+            lzStats.rxErrors++;
+            return -1;
+        }
+        lzStats.rxInBytes += bodyLen;
+        lzStats.rxOutBytes += n;
+        body = linkScratch;
+        bodyLen = n;
+    }
+
+    if (flags & (LINK_FLAG_DELTA_FULL | LINK_FLAG_DELTA))
+    {
+        int resyncSlot = -1;
+        int n = deltaDecode(src, body, bodyLen, flags & LINK_FLAG_DELTA, out, &resyncSlot);
+        if (resyncSlot >= 0)
+            linkQueueResync(src, resyncSlot);
+        return n;
+    }
+
+    memcpy(out, body, bodyLen);
+    return bodyLen;
+}
+
+/*
+ * Mesh bookkeeping for an accepted frame: learns routes, suppresses
+ * duplicates and queues a copy for forwarding. Returns true when the frame
+ * is also meant for this relay.
+ */
+static bool linkMeshReceive(const uint8_t *in, size_t len, const mesh_header_t &hdr, int16_t rssi, int8_t snr)
+{
+    unsigned long now = millis();
+    uint8_t self = config.relay_address;
+    uint8_t transmitter = in[1];
+
+    if (hdr.origin == self)
+        return false;
+    meshLearn(hdr.origin, transmitter, hdr.hops + 1, rssi, snr, now);
+    if (transmitter != hdr.origin)
+        meshLearn(transmitter, transmitter, 1, rssi, snr, now);
+    if (meshIsDuplicate(hdr.origin, hdr.seq))
+        return false;
+
+    if (hdr.final != self)
+    {
+        if (hdr.ttl > 1)
+        {
+            memcpy(linkScratch, in, len);
+            mesh_header_t fwd = hdr;
+            fwd.hops++;
+            fwd.ttl--;
+            linkScratch[0] = hdr.final == ROUTE_BROADCAST ? ROUTE_BROADCAST : meshNextHop(hdr.final, ROUTE_BROADCAST, now);
+            linkScratch[1] = self;
+            meshWriteHeader(linkScratch + ROUTE_HDR_SIZE, fwd);
+            meshQueueForward(linkScratch, len, now, random(config.mesh_jitter_ms + 1));
+        }
+        else
+        {
+            meshStats.ttlExpired++;
+        }
+    }
+
+    bool forUs = hdr.final == self || hdr.final == ROUTE_BROADCAST;
+    if (forUs)
+        meshStats.delivered++;
+    return forUs;
+}
+
+/*
+ * Decodes a received frame into out. Returns the payload length to forward to
+ * serial, or -1 when there is nothing to forward (control frames, frames for
+ * other relays, drops).
+ */
+int linkDecode(const uint8_t *in, size_t len, uint8_t *out, int16_t rssi, int8_t snr)
+{
+    linkRxStart = tsLastRxDoneMs(millis()) - Radio.TimeOnAir(radioModem(), len);
+    scanHeard();
+    if (!config.routing_enabled)
+        return linkDecodeBody(in, len, out, ROUTE_BROADCAST);
+
+    if (len < ROUTE_HDR_SIZE || !routeAccepts(in[0], config.relay_address))
+    {
+        routeStats.foreignDropped++;
+        return -1;
+    }
+
+    size_t hdrLen = ROUTE_HDR_SIZE;
+    uint8_t src = in[1];
+    bool broadcast = in[0] == ROUTE_BROADCAST;
+    if (config.mesh_enabled)
+    {
+        if (len < ROUTE_HDR_SIZE + MESH_HDR_SIZE)
+            return -1;
+        mesh_header_t hdr;
+        meshReadHeader(in + ROUTE_HDR_SIZE, &hdr);
+        if (!linkMeshReceive(in, len, hdr, rssi, snr))
+            return -1;
+        hdrLen += MESH_HDR_SIZE;
+        src = hdr.origin;
+        broadcast = hdr.final == ROUTE_BROADCAST;
+    }
+
+    int n = linkDecodeBody(in + hdrLen, len - hdrLen, out, src);
+    if (n < 0)
+        return n;
+    if (!routeOnReceive(src, out, n, config.route_protocol, broadcast))
+        return -1;
+    return n;
+}
+
+// Builds the next pending control frame into out, returns 0 when none is due.
+// The request stays pending until linkCommitCtrl(), so a frame lost to a busy
+// channel is built again on the next pass.
+size_t linkNextCtrlFrame(uint8_t *out)
+{
+    if (linkResyncCount == 0)
+        return 0;
+    // Addressed to the relay whose slot broke
+    linkCtrlBuilt = true;
+    size_t o = linkWriteHeaders(out, linkResync[0].src);
+    out[o++] = LINK_FLAG_CTRL;
+    out[o++] = LINK_CTRL_RESYNC;
+    out[o++] = linkResync[0].slot;
+    return o;
+}
+
+// Call once the frame from linkNextCtrlFrame() has been handed to the radio
+void linkCommitCtrl()
+{
+    if (!linkCtrlBuilt || linkResyncCount == 0)
+        return;
+    linkCtrlBuilt = false;
+    linkResyncCount--;
+    memmove(linkResync, linkResync + 1, linkResyncCount * sizeof(link_resync_t));
+}
+
+static uint32_t linkAirtime(uint8_t len)
+{
+    return Radio.TimeOnAir(radioModem(), len);
+}
+
+// Head-end: builds the superframe beacon, resizing slots for the current radio settings
+size_t linkTdmaBeacon(uint8_t *out)
+{
+    size_t hdrLen = linkWriteHeaders(out, ROUTE_BROADCAST);
+    size_t airLen = hdrLen + 2 + tdmaBeaconSize();
+    tdmaResize(linkAirtime, LORA_BUFFER - 1 - linkMaxPayload(), airLen, config.tdma_guard_ms);
+    out[hdrLen] = LINK_FLAG_CTRL;
+    out[hdrLen + 1] = LINK_CTRL_TDMA_BEACON;
+    return hdrLen + 2 + tdmaBuildBeacon(out + hdrLen + 2);
+}
+
+// Broadcast of our sniff period, peers stretch their preamble to it
+size_t linkSniffFrame(uint8_t *out, uint16_t sleepMs)
+{
+    size_t o = linkWriteHeaders(out, ROUTE_BROADCAST);
+    out[o++] = LINK_FLAG_CTRL;
+    out[o++] = LINK_CTRL_SNIFF;
+    out[o++] = sleepMs & 0xFF;
+    out[o++] = sleepMs >> 8;
+    return o;
+}
+
+size_t linkProbeFrame(uint8_t *out, uint32_t freq, bool heard)
+{
+    size_t o = linkWriteHeaders(out, ROUTE_BROADCAST);
+    out[o++] = LINK_FLAG_CTRL;
+    out[o++] = LINK_CTRL_PROBE;
+    for (int i = 0; i < 4; i++)
+        out[o++] = (freq >> (8 * i)) & 0xFF;
+    out[o++] = heard;
+    return o;
+}
+
+size_t linkChannelFrame(uint8_t *out, uint32_t freq, bool fsk)
+{
+    size_t o = linkWriteHeaders(out, ROUTE_BROADCAST);
+    out[o++] = LINK_FLAG_CTRL;
+    out[o++] = LINK_CTRL_CHANNEL;
+    for (int i = 0; i < 4; i++)
+        out[o++] = (freq >> (8 * i)) & 0xFF;
+    out[o++] = fsk;
+    return o;
+}
@@ -0,0 +1,174 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "settings.h"
+
+/*
+ * LZSS payload compression
+ *
+ * Heatshrink-style bit stream with the frame itself as the window, so no RAM
+ * is needed beyond the input and output buffers:
+ *
+ *   1 + 8 bits             literal byte
+ *   0 + 8 bits + 4 bits    back-reference, (distance - 1), (length - LZ_MIN_MATCH)
+ *
+ * The window is the frame itself preceded by a small preset dictionary of
+ * strings this relay sends over and over (beacon text), so short frames can
+ * reference it without any state shared between frames. Changing the
+ * dictionary breaks compatibility with relays running the old one.
+ *
+ * The stream is zero padded to a byte boundary; the decoder stops once fewer
+ * bits remain than the shortest token.
+ */
+
+#define LZ_WINDOW_BITS 8
+#define LZ_LENGTH_BITS 4
+#define LZ_MIN_MATCH 2
+#define LZ_MAX_MATCH (LZ_MIN_MATCH + (1 << LZ_LENGTH_BITS) - 1)
+#define LZ_LITERAL_BITS 9
+
+static const uint8_t lzDictionary[] = "BEACON: Device [] alive at 0123456789 ms\n";
+#define LZ_DICT_SIZE (sizeof(lzDictionary) - 1)
+
+// Dictionary followed by the frame being (de)compressed
+static uint8_t lzWork[LZ_DICT_SIZE + LORA_BUFFER];
+
+typedef struct
+{
+    uint32_t txInBytes;
+    uint32_t txOutBytes;
+    uint32_t txCompressed;
+    uint32_t txRaw;
+    uint32_t rxInBytes;
+    uint32_t rxOutBytes;
+    uint32_t rxErrors;
+} lz_stats_t;
+
+static lz_stats_t lzStats;
+
+typedef struct
+{
+    uint8_t *buf;
+    size_t max;
+    size_t bitPos;
+} lz_bit_writer_t;
+
+static bool lzPutBits(lz_bit_writer_t *w, uint16_t value, uint8_t count)
+{
+    if (((w->bitPos + count + 7) >> 3) > w->max)
+        return false;
+    while (count--)
+    {
+        size_t byte = w->bitPos >> 3;
+        uint8_t mask = 0x80 >> (w->bitPos & 7);
+        if ((w->bitPos & 7) == 0)
+            w->buf[byte] = 0;
+        if ((value >> count) & 1)
+            w->buf[byte] |= mask;
+        w->bitPos++;
+    }
+    return true;
+}
+
+static uint16_t lzGetBits(const uint8_t *buf, size_t *bitPos, uint8_t count)
+{
+    uint16_t value = 0;
+    while (count--)
+    {
+        value = (value << 1) | ((buf[*bitPos >> 3] >> (7 - (*bitPos & 7))) & 1);
+        (*bitPos)++;
+    }
+    return value;
+}
+
+/*
+ * Compresses len bytes into out. Returns the compressed size, or 0 when the
+ * result would not be smaller than the input (the caller then sends raw).
+ */
+size_t lzCompress(const uint8_t *data, size_t len, uint8_t *out, size_t outMax)
+{
+    if (len == 0 || len > LORA_BUFFER)
+        return 0;
+
+    memcpy(lzWork, lzDictionary, LZ_DICT_SIZE);
+    memcpy(lzWork + LZ_DICT_SIZE, data, len);
+    const uint8_t *in = lzWork;
+    size_t end = LZ_DICT_SIZE + len;
+
+    lz_bit_writer_t w = {out, outMax < len - 1 ? outMax : len - 1, 0};
+    size_t i = LZ_DICT_SIZE;
+    while (i < end)
+    {
+        size_t bestLen = 0;
+        size_t bestDist = 0;
+        size_t maxLen = end - i < LZ_MAX_MATCH ? end - i : LZ_MAX_MATCH;
+        size_t windowStart = i > (1 << LZ_WINDOW_BITS) ? i - (1 << LZ_WINDOW_BITS) : 0;
+        for (size_t j = windowStart; j < i && bestLen < maxLen; j++)
+        {
+            if (in[j] != in[i])
+                continue;
+            size_t k = 1;
+            while (k < maxLen && in[j + k] == in[i + k])
+                k++;
+            if (k > bestLen)
+            {
+                bestLen = k;
+                bestDist = i - j;
+            }
+        }
+
+        if (bestLen >= LZ_MIN_MATCH)
+        {
+            if (!lzPutBits(&w, 0, 1) ||
+                !lzPutBits(&w, bestDist - 1, LZ_WINDOW_BITS) ||
+                !lzPutBits(&w, bestLen - LZ_MIN_MATCH, LZ_LENGTH_BITS))
+                return 0;
+            i += bestLen;
+        }
+        else
+        {
+            if (!lzPutBits(&w, 1, 1) || !lzPutBits(&w, in[i], 8))
+                return 0;
+            i++;
+        }
+    }
+    return (w.bitPos + 7) >> 3;
+}
+
+/*
+ * Decompresses into out (at most outMax bytes). Returns the decompressed
+ * size or -1 on a malformed stream.
+ */
+int lzDecompress(const uint8_t *in, size_t len, uint8_t *out, size_t outMax)
+{
+    if (outMax > LORA_BUFFER)
+        outMax = LORA_BUFFER;
+    memcpy(lzWork, lzDictionary, LZ_DICT_SIZE);
+    size_t end = LZ_DICT_SIZE + outMax;
+
+    size_t bitPos = 0;
+    size_t totalBits = len * 8;
+    size_t o = LZ_DICT_SIZE;
+    while (totalBits - bitPos >= LZ_LITERAL_BITS)
+    {
+        if (lzGetBits(in, &bitPos, 1))
+        {
+            if (o >= end)
+                return -1;
+            lzWork[o++] = (uint8_t)lzGetBits(in, &bitPos, 8);
+            continue;
+        }
+
+        if (totalBits - bitPos < LZ_WINDOW_BITS + LZ_LENGTH_BITS)
+            return -1;
+        size_t dist = lzGetBits(in, &bitPos, LZ_WINDOW_BITS) + 1;
+        size_t run = lzGetBits(in, &bitPos, LZ_LENGTH_BITS) + LZ_MIN_MATCH;
+        if (dist > o || o + run > end)
+            return -1;
+        // Byte by byte so overlapping references repeat correctly
+        for (size_t k = 0; k < run; k++, o++)
+            lzWork[o] = lzWork[o - dist];
+    }
+    memcpy(out, lzWork + LZ_DICT_SIZE, o - LZ_DICT_SIZE);
+    return o - LZ_DICT_SIZE;
+}
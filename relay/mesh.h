@@ -0,0 +1,212 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "settings.h"
+
+/*
+ * Multi-hop store-and-forward
+ *
+ * Mesh frames extend the routing header with the end-to-end addressing:
+ *
+ *   [next hop][transmitter][origin][final dst][seq][hops:4|ttl:4][link frame...]
+ *
+ * Each relay remembers the (origin, seq) pairs it has seen in a small ring
+ * and drops repeats, so floods and loops die out. Frames for someone else are
+ * queued with a random delay before being sent on, with the ttl decremented
+ * and the next hop taken from the route table. Routes are learned from every
+ * received frame: the transmitter is a next hop towards the origin, and among
+ * candidates fewer hops win, then better SNR.
+ *
+ * All tables are fixed size; the forward queue drops new frames when full.
+ */
+
+#define MESH_HDR_SIZE 4
+
+typedef struct
+{
+    uint8_t origin;
+    uint8_t final;
+    uint8_t seq;
+    uint8_t hops;
+    uint8_t ttl;
+} mesh_header_t;
+
+typedef struct
+{
+    bool valid;
+    uint8_t dest;
+    uint8_t nextHop;
+    uint8_t hops;
+    int16_t rssi;
+    int8_t snr;
+    unsigned long lastSeen;
+} mesh_route_t;
+
+typedef struct
+{
+    bool used;
+    unsigned long due;
+    uint8_t len;
+    uint8_t data[LORA_BUFFER];
+} mesh_forward_t;
+
+typedef struct
+{
+    uint32_t originated;
+    uint32_t delivered;
+    uint32_t duplicates;
+    uint32_t forwarded;
+    uint32_t queueFull;
+    uint32_t ttlExpired;
+} mesh_stats_t;
+
+static uint16_t meshSeen[MESH_DUP_CACHE]; // origin << 8 | seq
+static uint8_t meshSeenCount = 0;
+static uint8_t meshSeenNext = 0;
+static mesh_route_t meshRoutes[MESH_ROUTES];
+static mesh_forward_t meshQueue[MESH_FWD_QUEUE];
+static uint8_t meshSeq = 0;
+static mesh_stats_t meshStats;
+
+void meshReset()
+{
+    meshSeenCount = 0;
+    meshSeenNext = 0;
+    memset(meshRoutes, 0, sizeof(meshRoutes));
+    memset(meshQueue, 0, sizeof(meshQueue));
+    memset(&meshStats, 0, sizeof(meshStats));
+}
+
+void meshWriteHeader(uint8_t *out, const mesh_header_t &hdr)
+{
+    out[0] = hdr.origin;
+    out[1] = hdr.final;
+    out[2] = hdr.seq;
+    out[3] = (hdr.hops << 4) | (hdr.ttl & 0x0F);
+}
+
+void meshReadHeader(const uint8_t *in, mesh_header_t *hdr)
+{
+    hdr->origin = in[0];
+    hdr->final = in[1];
+    hdr->seq = in[2];
+    hdr->hops = in[3] >> 4;
+    hdr->ttl = in[3] & 0x0F;
+}
+
+// Sequence number the next originated frame will carry
+uint8_t meshPeekSeq()
+{
+    return meshSeq;
+}
+
+uint8_t meshNextSeq()
+{
+    meshStats.originated++;
+    return meshSeq++;
+}
+
+// Returns true if (origin, seq) was seen before, otherwise remembers it
+bool meshIsDuplicate(uint8_t origin, uint8_t seq)
+{
+    uint16_t key = ((uint16_t)origin << 8) | seq;
+    for (uint8_t i = 0; i < meshSeenCount; i++)
+    {
+        if (meshSeen[i] == key)
+        {
+            meshStats.duplicates++;
+            return true;
+        }
+    }
+    meshSeen[meshSeenNext] = key;
+    meshSeenNext = (meshSeenNext + 1) % MESH_DUP_CACHE;
+    if (meshSeenCount < MESH_DUP_CACHE)
+        meshSeenCount++;
+    return false;
+}
+
+void meshLearn(uint8_t dest, uint8_t nextHop, uint8_t hops, int16_t rssi, int8_t snr, unsigned long now)
+{
+    mesh_route_t *slot = NULL;
+    mesh_route_t *oldest = &meshRoutes[0];
+    for (int i = 0; i < MESH_ROUTES; i++)
+    {
+        mesh_route_t &r = meshRoutes[i];
+        if (r.valid && r.dest == dest)
+        {
+            slot = &r;
+            break;
+        }
+        if (!r.valid)
+            oldest = &r;
+        else if (oldest->valid && r.lastSeen < oldest->lastSeen)
+            oldest = &r;
+    }
+
+    if (slot)
+    {
+        bool stale = now - slot->lastSeen > MESH_ROUTE_TIMEOUT_MS;
+        bool better = hops < slot->hops || (hops == slot->hops && snr > slot->snr + MESH_SNR_HYSTERESIS);
+        if (slot->nextHop != nextHop && !stale && !better)
+            return;
+    }
+    else
+    {
+        slot = oldest;
+    }
+
+    slot->valid = true;
+    slot->dest = dest;
+    slot->nextHop = nextHop;
+    slot->hops = hops;
+    slot->rssi = rssi;
+    slot->snr = snr;
+    slot->lastSeen = now;
+}
+
+// Next hop towards dest, or `fallback` (broadcast) when no fresh route exists
+uint8_t meshNextHop(uint8_t dest, uint8_t fallback, unsigned long now)
+{
+    for (int i = 0; i < MESH_ROUTES; i++)
+    {
+        const mesh_route_t &r = meshRoutes[i];
+        if (r.valid && r.dest == dest && now - r.lastSeen <= MESH_ROUTE_TIMEOUT_MS)
+            return r.nextHop;
+    }
+    return fallback;
+}
+
+// Queues a complete air frame to be sent after `delayMs`
+bool meshQueueForward(const uint8_t *frame, size_t len, unsigned long now, unsigned long delayMs)
+{
+    for (int i = 0; i < MESH_FWD_QUEUE; i++)
+    {
+        mesh_forward_t &q = meshQueue[i];
+        if (q.used)
+            continue;
+        q.used = true;
+        q.due = now + delayMs;
+        q.len = len;
+        memcpy(q.data, frame, len);
+        meshStats.forwarded++;
+        return true;
+    }
+    meshStats.queueFull++;
+    return false;
+}
+
+// Copies the next due forward into out and returns its length, 0 if none is due
+size_t meshNextForward(uint8_t *out, unsigned long now)
+{
+    for (int i = 0; i < MESH_FWD_QUEUE; i++)
+    {
+        mesh_forward_t &q = meshQueue[i];
+        if (q.used && (long)(now - q.due) >= 0)
+        {
+            memcpy(out, q.data, q.len);
+            q.used = false;
+            return q.len;
+        }
+    }
+    return 0;
+}
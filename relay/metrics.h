@@ -0,0 +1,100 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "Arduino.h"
+
+/*
+ * Fixed memory counters and histograms
+ *
+ * Latencies go into log2 buckets: bucket 0 holds 0, bucket i holds values in
+ * [2^(i-1), 2^i) and the last bucket everything above. RSSI and SNR already
+ * are logarithmic, so they use linear buckets of `width` dB from `base`.
+ *
+ * Every metric has a single writer (loop(), or the UART event task for
+ * overruns) and recording is a handful of adds with no locks or loops, so
+ * readers may see a sample half applied but writers never wait.
+ */
+
+#define METRICS_BUCKETS 24
+
+typedef struct
+{
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+    uint32_t bucket[METRICS_BUCKETS];
+} metrics_hist_t;
+
+typedef struct
+{
+    uint32_t serialFramesIn;
+    uint32_t serialBytesIn;
+    uint32_t serialFramesOut;
+    uint32_t serialBytesOut;
+    uint32_t airFramesTx;
+    uint32_t airBytesTx;
+    uint32_t airFramesRx;
+    uint32_t airBytesRx;
+    uint32_t lbtFail;
+    uint32_t txTimeout;
+    uint32_t crcError;
+    uint32_t truncated;
+    volatile uint32_t uartOverrun;
+} metrics_counters_t;
+
+#define METRICS_RSSI_BASE -140
+#define METRICS_RSSI_WIDTH 8
+#define METRICS_SNR_BASE -20
+#define METRICS_SNR_WIDTH 2
+
+static metrics_counters_t metrics;
+static metrics_hist_t histSerialToAir; // first serial byte -> TxDone, us
+static metrics_hist_t histAirToSerial; // RxDone -> last byte on the UART, us
+static metrics_hist_t histLbtWait;     // frame complete -> handed to the radio, us
+static metrics_hist_t histRssi;        // dBm
+static metrics_hist_t histSnr;         // dB
+
+static inline void metricsAdd(metrics_hist_t &h, int32_t value, uint32_t bucket)
+{
+    if (h.count == 0 || value < h.min)
+        h.min = value;
+    if (h.count == 0 || value > h.max)
+        h.max = value;
+    h.count++;
+    h.sum += value;
+    h.bucket[bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1]++;
+}
+
+static inline void metricsRecordLog(metrics_hist_t &h, uint32_t value)
+{
+    metricsAdd(h, (int32_t)value, value ? 32 - __builtin_clz(value) : 0);
+}
+
+static inline void metricsRecordLinear(metrics_hist_t &h, int32_t value, int32_t base, int32_t width)
+{
+    metricsAdd(h, value, value > base ? (value - base) / width : 0);
+}
+
+void metricsReset()
+{
+    memset(&metrics, 0, sizeof(metrics));
+    memset(&histSerialToAir, 0, sizeof(metrics_hist_t));
+    memset(&histAirToSerial, 0, sizeof(metrics_hist_t));
+    memset(&histLbtWait, 0, sizeof(metrics_hist_t));
+    memset(&histRssi, 0, sizeof(metrics_hist_t));
+    memset(&histSnr, 0, sizeof(metrics_hist_t));
+}
+
+// HIST,<name>,<scale>,n=,min=,avg=,max=,b=<b0>/<b1>/... up to the last used bucket
+void metricsPrintHist(const char *name, const char *scale, const metrics_hist_t &h)
+{
+    Serial.printf("HIST,%s,%s,n=%lu,min=%ld,avg=%ld,max=%ld,b=", name, scale, h.count, h.min,
+                  h.count ? (int32_t)(h.sum / h.count) : 0, h.max);
+    int last = METRICS_BUCKETS - 1;
+    while (last > 0 && h.bucket[last] == 0)
+        last--;
+    for (int i = 0; i <= last; i++)
+        Serial.printf(i ? "/%lu" : "%lu", h.bucket[i]);
+    Serial.println();
+}
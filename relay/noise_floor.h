@@ -0,0 +1,104 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "settings.h"
+
+/*
+ * Noise floor estimate
+ *
+ * While RX is armed and idle the channel RSSI is sampled every
+ * NOISE_SAMPLE_MS into a histogram of 1 dB bins. Once NOISE_WINDOW samples
+ * are in, every bin is halved, so old samples fade out and the memory stays
+ * fixed. The floor is the NOISE_QUANTILE percentile: low enough that frames
+ * on the air do not pull it up, high enough to follow a raised floor.
+ *
+ * With auto LBT the threshold follows floor + margin, clamped to
+ * NOISE_LBT_MIN..NOISE_LBT_MAX. It only moves once the new value differs by
+ * NOISE_HYSTERESIS_DB, so it does not flap by a dB. The tuned value is kept
+ * in noiseLbt, apart from the configured threshold, which AT+SAVE stores and
+ * LBT falls back to until the floor is known. The histogram starts over on
+ * every frequency or modem change.
+ */
+
+#define NOISE_BINS (NOISE_RSSI_MAX - NOISE_RSSI_MIN + 1)
+
+static uint16_t noiseBins[NOISE_BINS];
+static uint16_t noiseCount = 0;       // samples in the histogram
+static uint32_t noiseTotal = 0;       // since boot
+static unsigned long noiseLastSample = 0;
+static unsigned long noiseLastUpdate = 0;
+static int8_t noiseLbt = 0;        // auto LBT threshold
+static bool noiseLbtValid = false; // set once enough samples are in
+
+bool noiseSampleDue(unsigned long now)
+{
+    if (now - noiseLastSample < NOISE_SAMPLE_MS)
+        return false;
+    noiseLastSample = now;
+    return true;
+}
+
+void noiseSample(int16_t rssi)
+{
+    if (rssi < NOISE_RSSI_MIN)
+        rssi = NOISE_RSSI_MIN;
+    if (rssi > NOISE_RSSI_MAX)
+        rssi = NOISE_RSSI_MAX;
+    noiseBins[rssi - NOISE_RSSI_MIN]++;
+    noiseTotal++;
+    if (++noiseCount < NOISE_WINDOW)
+        return;
+    noiseCount = 0;
+    for (int i = 0; i < NOISE_BINS; i++)
+    {
+        noiseBins[i] /= 2;
+        noiseCount += noiseBins[i];
+    }
+}
+
+// RSSI below which pct percent of the samples fall
+int16_t noiseQuantile(uint8_t pct)
+{
+    uint32_t target = (uint32_t)noiseCount * pct / 100, seen = 0;
+    for (int i = 0; i < NOISE_BINS; i++)
+    {
+        seen += noiseBins[i];
+        if (seen > target)
+            return NOISE_RSSI_MIN + i;
+    }
+    return NOISE_RSSI_MAX;
+}
+
+int16_t noiseFloor()
+{
+    return noiseQuantile(NOISE_QUANTILE);
+}
+
+// LBT threshold the current floor asks for
+int8_t noiseThreshold(uint8_t margin)
+{
+    int16_t t = noiseFloor() + margin;
+    return t < NOISE_LBT_MIN ? NOISE_LBT_MIN : t > NOISE_LBT_MAX ? NOISE_LBT_MAX : t;
+}
+
+// True when auto LBT moved noiseLbt
+bool noiseUpdate(unsigned long now, uint8_t margin)
+{
+    if (now - noiseLastUpdate < NOISE_UPDATE_MS || noiseCount < NOISE_MIN_SAMPLES)
+        return false;
+    noiseLastUpdate = now;
+    int8_t next = noiseThreshold(margin);
+    int diff = next - noiseLbt;
+    if (noiseLbtValid && diff < NOISE_HYSTERESIS_DB && diff > -NOISE_HYSTERESIS_DB)
+        return false;
+    noiseLbt = next;
+    noiseLbtValid = true;
+    return true;
+}
+
+void noiseReset()
+{
+    memset(noiseBins, 0, sizeof(noiseBins));
+    noiseCount = 0;
+    noiseLbtValid = false;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <stdint.h>
+#include "settings.h"
+
+/*
+ * Warm sleep between polling windows
+ *
+ * For sites where the head-end polls on a fixed period. Every frame seen on
+ * the air or the serial bus re-anchors the schedule. Once nothing moved for
+ * `window` ms the SX1262 is put into sleep with warm start (configuration
+ * retained), and woken SLEEP_WAKE_LEAD_MS before the next expected poll at
+ * anchor + n * period. Waking only re-arms RX; the modem settings and
+ * calibration stay in the chip, so nothing is uploaded again.
+ *
+ * Serial data for the air wakes the radio early. Wake-to-RX-ready latency is
+ * measured from the wake command until RX is armed.
+ */
+
+typedef struct
+{
+    uint32_t sleeps;
+    uint32_t earlyWakes; // woken by serial data before the window
+    uint64_t asleepMs;
+    uint32_t wakeLastUs;
+    uint32_t wakeMaxUs;
+    uint64_t wakeSumUs;
+} sleep_stats_t;
+
+static bool sleepAsleep = false;
+static unsigned long sleepAnchor = 0;   // last traffic
+static unsigned long sleepActivity = 0; // last traffic or wake
+static unsigned long sleepStart = 0;
+static unsigned long sleepWakeAt = 0;
+static sleep_stats_t sleepStats;
+
+// Any frame on the air or the bus
+void sleepOnTraffic(unsigned long now)
+{
+    sleepAnchor = now;
+    sleepActivity = now;
+}
+
+// True when the radio may go to sleep now; sets the wake time
+bool sleepDue(uint32_t period, uint32_t window, unsigned long now)
+{
+    if (period == 0 || sleepAsleep || now - sleepActivity < window)
+        return false;
+    // Next poll after now, minus the wake lead
+    unsigned long next = sleepAnchor + period;
+    while ((long)(next - SLEEP_WAKE_LEAD_MS - now) <= 0)
+        next += period;
+    sleepWakeAt = next - SLEEP_WAKE_LEAD_MS;
+    if (sleepWakeAt - now < SLEEP_MIN_MS)
+        return false;
+    sleepAsleep = true;
+    sleepStart = now;
+    sleepStats.sleeps++;
+    return true;
+}
+
+bool sleepWakeDue(unsigned long now)
+{
+    return sleepAsleep && (long)(now - sleepWakeAt) >= 0;
+}
+
+// Radio is back in RX; wakeUs is the time the wake took
+void sleepWoke(unsigned long now, uint32_t wakeUs, bool early)
+{
+    sleepAsleep = false;
+    sleepActivity = now;
+    sleepStats.asleepMs += now - sleepStart;
+    if (early)
+        sleepStats.earlyWakes++;
+    sleepStats.wakeLastUs = wakeUs;
+    sleepStats.wakeSumUs += wakeUs;
+    if (wakeUs > sleepStats.wakeMaxUs)
+        sleepStats.wakeMaxUs = wakeUs;
+}
+
+// Share of time since boot the radio slept, in percent
+uint32_t sleepDuty(unsigned long uptime)
+{
+    uint64_t asleep = sleepStats.asleepMs + (sleepAsleep ? uptime - sleepStart : 0);
+    return uptime ? (uint32_t)(asleep * 100 / uptime) : 0;
+}
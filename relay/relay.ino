@@ -2,14 +2,27 @@
 #include "Arduino.h"
 #include "settings.h"
 #include "command_parser.h"
+#include "link_frame.h"
+#include "debug_log.h"
+#include "radio_sleep.h"
+#include "rx_pool.h"
+#include "uart_egress.h"
+#include "flow_control.h"
 #include "esp_task_wdt.h"
 #include "esp_system.h"
 #include "esp_mac.h"
+#include "driver/sx126x.h"
 
 
 
 char txpacket[LORA_BUFFER];
-char rxpacket[LORA_BUFFER];
+uint8_t airpacket[LORA_BUFFER];
+uint8_t slotpacket[LORA_BUFFER];  // Frame waiting for our TDMA slot
+size_t slotpacketLen = 0;
+tx_trace_t slotTrace;             // its timestamps
+uint8_t slotraw[LORA_BUFFER];     // its serial payload, becomes the delta reference once sent
+uint8_t meshpacket[LORA_BUFFER];  // Mesh forward waiting for our TDMA slot
+size_t meshpacketLen = 0;
 
 static RadioEvents_t RadioEvents;
 
@@ -20,9 +33,9 @@ typedef enum {
 } States_t;
 
 States_t state;
-volatile bool rxRecieved = false;
+volatile bool txBusy = false;
 bool dio_triggered = false;
-int16_t Rssi, rxSize;
+int16_t Rssi;
 unsigned long bootTime = 0;
 uint8_t mac[6];
 char macStr[18];
@@ -30,81 +43,197 @@ char macStr[18];
 void OnTxDone(void);
 void OnTxTimeout(void);
 void OnRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr);
+void OnRxError(void);
 
-void printfDebug(const char *fmt, ...) {
-  if (!config.print_debug)
+// Drop frames addressed to another relay straight from the radio buffer,
+// before Radio.IrqProcess() reads the whole payload out
+void discardForeignFrame(uint16_t irq) {
+  if (!config.routing_enabled || !(irq & IRQ_RX_DONE) || (irq & IRQ_CRC_ERROR))
     return;
-  va_list args;
-  va_start(args, fmt);
-  Serial.printf(fmt, args);
-  va_end(args);
+
+  uint8_t len = 0, start = 0;
+  SX126xGetRxBufferStatus(&len, &start);
+  if (len < ROUTE_HDR_SIZE)
+    return;
+  uint8_t hdr[ROUTE_HDR_SIZE];
+  SX126xReadBuffer(start, hdr, ROUTE_HDR_SIZE);
+  if (!routeAccepts(hdr[0], config.relay_address)) {
+    SX126xClearIrqStatus(IRQ_RADIO_ALL);
+    routeStats.foreignDropped++;
+  }
+}
+
+void radioSend(uint8_t *frame, size_t len) {
+  Radio.Send(frame, len);
+  txBusy = true;
+  metrics.airFramesTx++;
+  metrics.airBytesTx += len;
+  traceEvent(TRACE_TX, 0, len, 0, 0, 0, Radio.TimeOnAir(radioModem(), len));
+}
+
+// Listen before talk, then hand the frame to the radio. Returns false when
+// the channel stayed busy for every retry.
+bool sendWithLbt(uint8_t *frame, size_t len) {
+  for (size_t i = 0; i < config.lbt_retry; i++) {
+    Radio.Standby();
+    if (Radio.IsChannelFree(radioModem(), config.rf_frequency, lbtThreshold(), config.lbt_time)) {
+      radioSend(frame, len);
+      printfDebug("[TX] LBT passed, sent packet.\n");
+      return true;
+    }
+    Rssi = Radio.Rssi(radioModem());
+    printfDebug("[TX] LBT failed, Rsii: %d, retrying...\n", Rssi);
+    delay(50);
+  }
+  metrics.lbtFail++;
+  traceEvent(TRACE_LBT_FAIL, 0, len, Rssi);
+  return false;
+}
+
+void onSerialError(hardwareSerial_error_t err) {
+  if (err == UART_FIFO_OVF_ERROR || err == UART_BUFFER_FULL_ERROR)
+    metrics.uartOverrun++;
+}
+
+// TDMA replaces LBT while we are synced and own at least one slot
+bool tdmaActive() {
+  return config.tdma_mode != TDMA_MODE_OFF && tdmaSynced && tdmaOwnsAnySlot(config.relay_address);
+}
+
+// Control or mesh forward frame in our TDMA slot, or after LBT. False when it has to wait
+// for the slot or the channel stayed busy.
+bool sendCtrlFrame(uint8_t *frame, size_t len) {
+  if (!tdmaActive())
+    return sendWithLbt(frame, len);
+  uint32_t airMs = Radio.TimeOnAir(radioModem(), len);
+  unsigned long now = millis();
+  if (!tdmaCanSend(config.relay_address, now, airMs))
+    return false;
+  Radio.Standby();
+  radioSend(frame, len);
+  tdmaRecord(now, airMs, true);
+  return true;
+}
+
+// New serial data is only picked up once the previous frame left and our
+// own echo (RS485 collision detect) has been dropped
+bool serialFrameWaiting() {
+  return !egressEchoPending() && Serial.available() && slotpacketLen == 0;
+}
+
+void processRadioIrq() {
+  // Peek at the IRQ flags before the driver reads and clears them
+  if (tsIsrPending || (config.routing_enabled && digitalRead(LORA_DIO1_PIN))) {
+    uint16_t irq = SX126xGetIrqStatus();
+    tsOnIrqStatus(irq);
+    discardForeignFrame(irq);
+  }
+  Radio.IrqProcess();
 }
 
-void printHex(const char *label, const uint8_t *data, size_t len) {
-  Serial.print(label);
-  for (size_t i = 0; i < len; i++) {
-    Serial.printf("%02X ", data[i]);
+// RX with preamble and header IRQs routed to DIO1 for timestamps. Continuous,
+// or duty-cycled in sniff mode, where it has to be re-armed after every frame.
+void startReceive() {
+  uint16_t mask = IRQ_RX_DONE | IRQ_RX_TX_TIMEOUT | IRQ_CRC_ERROR | IRQ_HEADER_ERROR |
+                  IRQ_PREAMBLE_DETECTED | IRQ_HEADER_VALID | IRQ_SYNCWORD_VALID;
+  if (config.sniff_sleep_ms > 0) {
+    // Any command wakes the chip out of its sleep phase, so IRQs go first
+    Radio.Standby();
+    SX126xSetDioIrqParams(mask, mask, IRQ_RADIO_NONE, IRQ_RADIO_NONE);
+    uint32_t rxUs = sniffRxUs(config.lora_spreading_factor, config.lora_bandwidth);
+    Radio.SetRxDutyCycle(sniffTicks(rxUs), sniffTicks((uint32_t)config.sniff_sleep_ms * 1000));
+    return;
   }
-  Serial.println();
+  Radio.Rx(0);
+  SX126xSetDioIrqParams(mask, mask, IRQ_RADIO_NONE, IRQ_RADIO_NONE);
+}
+
+// Wakes the radio from warm sleep straight into RX
+void wakeRadio(bool early) {
+  int64_t t0 = esp_timer_get_time();
+  startReceive();
+  sleepWoke(millis(), esp_timer_get_time() - t0, early);
+}
+
+// Sleeping is left to sites where nothing else needs the receiver
+bool sleepAllowed() {
+  return !config.mesh_enabled && config.tdma_mode == TDMA_MODE_OFF && slotpacketLen == 0 &&
+         linkResyncCount == 0 && rxPoolPending() == 0 && !serialFrameWaiting();
 }
 
 void setup() {
   bootTime = millis();  // store the time at boot
+  tsBoot(BOOT_SETUP);
 
-  Serial.setRxBufferSize(512);
-  Serial.setTxBufferSize(512);
+  Serial.setRxBufferSize(UART_RX_BUFFER_SIZE);
+  Serial.setTxBufferSize(UART_BUFFER_SIZE);
   Serial.begin(115200, SERIAL_8N1);
-  delay(500);
-
 
-  printfDebug("[INIT] Starting LoRa RS485 bridge...\n");
-  loadConfig();  // Load LoRa config from NVS
-  printfDebug("[INIT] Loaded NVS");
-  Serial.printf("Setting baud rate %d bd\n", config.modbus_baudrate);
-  delay(500); 
+  // Fast boot takes the config from RTC memory and leaves NVS for later
+  bootWarm = rtcConfigRestore();
+  if (!bootWarm) {
+    loadConfig();  // Load LoRa config from NVS
+  }
+  if (!config.fast_boot) {
+    delay(500);
+    Serial.printf("Setting baud rate %d bd\n", config.modbus_baudrate);
+    delay(500);
+  }
   Serial.updateBaudRate(config.modbus_baudrate);
+  if (config.rs485_mode != RS485_OFF && !rs485Apply(config.rs485_mode, config.rs485_de_pin)) {
+    Serial.println("[INIT] RS485 mode failed, plain UART.");
+  }
+  if (config.flow_mode != FLOW_OFF && !flowApply(config.flow_mode, config.flow_rts_pin, config.flow_cts_pin)) {
+    Serial.println("[INIT] Flow control failed, running without.");
+  }
+  tsBoot(BOOT_CONFIG);
 
   Mcu.begin(HELTEC_BOARD, SLOW_CLK_TPYE);
+  tsBoot(BOOT_MCU);
 
   RadioEvents.TxDone = OnTxDone;
   RadioEvents.TxTimeout = OnTxTimeout;
   RadioEvents.RxDone = OnRxDone;
+  RadioEvents.RxError = OnRxError;
 
   int err = Radio.Init(&RadioEvents);
   if (err != 0) {
     Serial.printf("[ERROR] Radio Init failed! Code: %d\n", err);
   }
-  Radio.SetTxConfig(MODEM_LORA,
-                    config.tx_output_power,
-                    0,  // frequency deviation (not used in LoRa)
-                    config.lora_bandwidth,
-                    config.lora_spreading_factor,
-                    config.lora_codingrate,
-                    config.lora_preamble_length,
-                    config.lora_fix_length_payload_on,
-                    true,  // CRC on
-                    0,     // Freq hop
-                    0,     // Hop period
-                    config.lora_iq_inversion_on,
-                    config.tx_timeout);
-  Radio.SetRxConfig(MODEM_LORA,
-                    config.lora_bandwidth,
-                    config.lora_spreading_factor,
-                    config.lora_codingrate,
-                    0,
-                    config.lora_preamble_length,
-                    config.lora_symbol_timeout,
-                    config.lora_fix_length_payload_on,
-                    0,     // No fixed payload len
-                    true,  // CRC on
-                    0,     // Freq hop
-                    0,     // Hop period
-                    config.lora_iq_inversion_on,
-                    true);
-
-  Radio.SetChannel(config.rf_frequency);
+  // Timestamp DIO1 edges before the driver's handler sees them
+  attachInterrupt(LORA_DIO1_PIN, onDio1Isr, RISING);
+  tsBoot(BOOT_RADIO_INIT);
+
+  // Needed on warm boots too: Radio.Init() pulses NRST, which clears the
+  // modem settings in the SX1262
+  applyConfigToRadio();
+  tsBoot(BOOT_RADIO_CONFIG);
+
+  startReceive();
+  state = IDLE;
+  tsBoot(BOOT_RX_ARMED);
+
+  // Everything below is not needed to receive the first frame
+  if (bootWarm) {
+    // Routing tables, TDMA slots and limits still come from NVS
+    device_config_t radio;
+    memcpy(&radio, &config, sizeof(config));
+    loadConfig();
+    config.lastBeaconMillis = radio.lastBeaconMillis;
+    // Other fields differing (routing, LBT, ...) need no second radio setup
+    if (!radioConfigEqual(radio, config)) {
+      applyConfigToRadio();
+      startReceive();
+    }
+  }
+  rtcConfigStore();
 
-  state = STATE_TX;
+  Serial.onReceiveError(onSerialError);
+  debugLogBegin();
+  healthBegin();
+  printfDebug("[INIT] Starting LoRa RS485 bridge...\n");
+  if (traceBegin())
+    traceEvent(TRACE_BOOT, esp_reset_reason());
 
   // Adding HW watchdog
   esp_task_wdt_config_t dog_cfg=
@@ -120,41 +249,199 @@ void setup() {
   esp_read_mac(mac, ESP_MAC_WIFI_STA); 
   sprintf(macStr, MACSTR, MAC2STR(mac));
 
-  Serial.printf("[INIT] Radio initialized at %d bd, entering TX mode...\n", config.modbus_baudrate);
-  //esp_task_wdt_reset();
+  if (!config.fast_boot) {
+    Serial.printf("[INIT] Radio initialized at %d bd, listening...\n", config.modbus_baudrate);
+  }
+  tsBoot(BOOT_DONE);
 }
 
 void loop() {
 
-  Radio.IrqProcess();
+  processRadioIrq();
+
+  // Back to RX before the next polling window, or early for serial data
+  if (sleepAsleep && (serialFrameWaiting() || sleepWakeDue(millis()))) {
+    wakeRadio(!sleepWakeDue(millis()));
+  }
 
-  if (config.beaconEnabled && (millis() - config.lastBeaconMillis >= config.beaconIntervalMs)) {
+  // The TDMA head-end beacons once per superframe instead of the alive text
+  bool tdmaHeadEnd = config.tdma_mode == TDMA_MODE_HEADEND && tdmaSlotCount > 0;
+  unsigned long beaconInterval = tdmaHeadEnd ? tdmaSuperframeMs() : config.beaconIntervalMs;
+  if ((config.beaconEnabled || tdmaHeadEnd) && !txBusy && (millis() - config.lastBeaconMillis >= beaconInterval)) {
     config.lastBeaconMillis = millis();
-    String beacon = "BEACON: Device [" + String(macStr) + "] alive at " + String(millis()) + " ms\n";
-    Serial.print(beacon);
-    Radio.Send((uint8_t *)beacon.c_str(), beacon.length());
+    if (sleepAsleep)
+      wakeRadio(true);
+    if (tdmaHeadEnd) {
+      size_t airLen = linkTdmaBeacon(airpacket);
+      Radio.Standby();
+      radioSend(airpacket, airLen);
+      linkCommitHeaders();
+      tdmaStartSuperframe(config.lastBeaconMillis);
+    } else {
+      int beaconLen = snprintf(txpacket, sizeof(txpacket), "BEACON: Device [%s] alive at %lu ms\n", macStr, millis());
+      debugLogBusTake();
+      Serial.write((uint8_t *)txpacket, beaconLen);
+      egressEchoExpect(beaconLen);
+      debugLogBusGive();
+      size_t airLen = linkEncode((const uint8_t *)txpacket, beaconLen, airpacket, false);
+      radioSend(airpacket, airLen);
+      linkCommitHeaders();
+    }
   }
 
+  if (config.tdma_mode == TDMA_MODE_MEMBER) {
+    tdmaCheckSync(millis());
+  }
+
+  // Send the held frame once our slot has room for it
+  if (slotpacketLen > 0 && !txBusy) {
+    uint32_t airMs = Radio.TimeOnAir(radioModem(), slotpacketLen);
+    unsigned long now = millis();
+    if (!tdmaActive()) {
+      if (sendWithLbt(slotpacket, slotpacketLen)) {
+        tsTxStart(slotTrace);
+        linkCommitTx(slotraw);
+      } else {
+        state = STATE_RX;
+      }
+      slotpacketLen = 0;
+    } else if (tdmaCanSend(config.relay_address, now, airMs)) {
+      Radio.Standby();
+      radioSend(slotpacket, slotpacketLen);
+      tsTxStart(slotTrace);
+      linkCommitTx(slotraw);
+      tdmaRecord(now, airMs, true);
+      slotpacketLen = 0;
+    }
+  }
+
+  // Answer resync requests from the peer's delta decoder
+  if (state == IDLE && !txBusy) {
+    size_t ctrlLen = linkNextCtrlFrame(airpacket);
+    if (ctrlLen > 0) {
+      if (sendCtrlFrame(airpacket, ctrlLen)) {
+        linkCommitHeaders();
+        linkCommitCtrl();
+      }
+      else
+        state = STATE_RX;
+    }
+  }
+
+  // Announce a channel or modem change to the other relays, follow it, then
+  // make sure a peer is there or go back
+  if (state == IDLE && !txBusy && scanAnnounceDue()) {
+    if (sendCtrlFrame(airpacket, linkChannelFrame(airpacket, scanAnnounceFreq, scanAnnounceFsk))) {
+      linkCommitHeaders();
+      scanAnnounceSent();
+    }
+    else
+      state = STATE_RX;
+  }
+  if (state == IDLE && !txBusy && scanProbeDue(millis())) {
+    if (sendCtrlFrame(airpacket, linkProbeFrame(airpacket, config.rf_frequency, scanConfirmed))) {
+      linkCommitHeaders();
+      scanProbeSent(millis());
+    }
+    else
+      state = STATE_RX;
+  }
+  scanConfirmCheck(millis());
+  if (scanPendingFreq != 0 && !txBusy) {
+    uint32_t oldFreq = config.rf_frequency;
+    bool oldFsk = config.fsk_enabled;
+    config.rf_frequency = scanPendingFreq;
+    config.fsk_enabled = scanPendingFsk;
+    scanPendingFreq = 0;
+    if (!scanPendingFallback)
+      scanStartConfirm(oldFreq, oldFsk, millis());
+    scanPendingFallback = false;
+    applyConfigToRadio();
+    state = STATE_RX;
+  }
+
+  // Tell the peers our sniff period, then sleep on it; take the one they announce
+  if (state == IDLE && !txBusy && sniffAnnounceDue(millis(), config.sniff_sleep_ms, linkFramingEnabled())) {
+    if (sendCtrlFrame(airpacket, linkSniffFrame(airpacket, sniffAnnounceMs))) {
+      linkCommitHeaders();
+      sniffAnnounceSent(millis(), config.sniff_sleep_ms);
+    }
+    else
+      state = STATE_RX;
+  }
+  if (sniffPendingMs >= 0 && !txBusy && !sleepAsleep) {
+    config.sniff_sleep_ms = sniffPendingMs;
+    sniffPendingMs = -1;
+    startReceive();
+  }
+  if (sniffPeerPendingMs >= 0 && !txBusy && !sleepAsleep) {
+    config.peer_sniff_ms = sniffPeerPendingMs;
+    sniffPeerPendingMs = -1;
+    applyConfigToRadio();
+    state = STATE_RX;
+  }
+
+  // Pass on mesh frames whose forwarding delay has expired; under TDMA the
+  // forward is held for our slot like our own frames
+  if (config.mesh_enabled && state == IDLE && !txBusy) {
+    if (meshpacketLen == 0)
+      meshpacketLen = meshNextForward(meshpacket, millis());
+    if (meshpacketLen > 0) {
+      if (sendCtrlFrame(meshpacket, meshpacketLen)) {
+        meshpacketLen = 0;
+      } else if (!tdmaActive()) {
+        printfDebug("[MESH] Forward dropped, channel busy.\n");
+        meshpacketLen = 0;
+        state = STATE_RX;
+      }
+    }
+  }
+
+  flowService(Serial.available());
+
   // Trigger TX if new RS485 data available
-  if (Serial.available()) {
+  if (serialFrameWaiting()) {
     state = STATE_TX;
-  } else if (rxRecieved == true) {
-    // Send available data to serial
-    Serial.write((uint8_t *)rxpacket, rxSize);
-    memset(rxpacket, 0, sizeof(rxpacket));
-    rxRecieved = false;
+  } else if (rx_slot_t *slot = rxPoolPeek()) {
+    // Hand the oldest received frame to the UART driver, it drains in the background
+    debugLogBusTake();
+    bool written = egressWrite(slot->data, slot->len);
+    debugLogBusGive();
+    if (written) {
+      tsUartQueued(slot->rxDoneUs, slot->readoutUs);
+      metrics.serialFramesOut++;
+      metrics.serialBytesOut += slot->len;
+      rxPoolRelease();
+    }
+  }
+  if (egressDone()) {
+    debugLogBusBusy();
+    tsUartDrained();
+  }
+
+  static States_t lastState = state;
+  if (state != lastState) {
+    traceEvent(TRACE_STATE, lastState, 0, 0, 0, state);
+    lastState = state;
   }
 
   switch (state) {
     case STATE_TX:
       {
+        if (egressEchoPending()) {
+          state = IDLE;
+          break;
+        }
         // Read non terminated data from input serial
         unsigned long lastByteTime = millis();
         size_t len = 0;
-        while (millis() - lastByteTime < config.modbus_read_delay && len < LORA_BUFFER - 1) {
+        size_t maxLen = linkMaxPayload();
+        while (millis() - lastByteTime < config.modbus_read_delay && len < maxLen) {
           if (Serial.available()) {
+            if (len == 0)
+              tsUartFirstByte();
             int available = Serial.available();
-            int toRead = min(available, (int)(LORA_BUFFER - 1 - len));  // prevent overflow
+            int toRead = min(available, (int)(maxLen - len));  // prevent overflow
 
             int bytesRead = Serial.readBytes(txpacket + len, toRead);
             len += bytesRead;
@@ -163,33 +450,42 @@ void loop() {
         }
         // Sent data or handle at command
         if (len > 0) {
-          if (config.print_debug) {
-            printHex("[TX] Read serial:", (uint8_t *)txpacket, len);
-            printfDebug("MBSUDELAY: %d\n", config.modbus_read_delay);
-          }
+          tsUartGathered();
+          sleepOnTraffic(millis());
+          metrics.serialFramesIn++;
+          metrics.serialBytesIn += len;
+          if (len >= maxLen && Serial.available())
+            metrics.truncated++;
+          debugLogBusBusy();
+          printHex("[TX] Read serial: ", (uint8_t *)txpacket, len);
+          printfDebug("MBSUDELAY: %d\n", config.modbus_read_delay);
           // Handle AT command
           if (len >= 3 && strncmp(txpacket, "AT+", 3) == 0) {
             txpacket[len] = '\0';
             String cmd = String(txpacket);
-            printfDebug("Recieved AT command %s\n", cmd.c_str());
+            printTextDebug("Recieved AT command: ", txpacket, len);
             cmd.trim();
+            debugLogBusTake();
             handleATCommand(cmd);
+            egressDropEcho();
+            debugLogBusGive();
             memset(txpacket, 0, sizeof(txpacket));
             state = STATE_RX;
             break;
           }
           // Handle data send
-          for (size_t i = 0; i < config.lbt_retry; i++) {
-            Radio.Standby();
-            if (Radio.IsChannelFree(MODEM_LORA, config.rf_frequency, config.lbt_rssi_threshold, config.lbt_time)) {
-              Radio.Send((uint8_t *)txpacket, len);
-              printfDebug("[TX] LBT passed, sent packet.\n");
-
-              break;
-            }
-            Rssi = Radio.Rssi(MODEM_LORA);
-            printfDebug("[TX] LBT failed, Rsii: %d, retrying...\n", Rssi);
-            delay(50);
+          size_t airLen = linkEncode((const uint8_t *)txpacket, len, airpacket);
+          if (tdmaActive()) {
+            // Held until our slot, loop() sends it
+            memcpy(slotpacket, airpacket, airLen);
+            slotpacketLen = airLen;
+            slotTrace = txTrace;
+            memcpy(slotraw, txpacket, len);
+            linkCommitHeaders();
+          } else if (sendWithLbt(airpacket, airLen)) {
+            linkCommitHeaders();
+            tsTxStart(txTrace);
+            linkCommitTx((const uint8_t *)txpacket);
           }
         }
 
@@ -199,12 +495,23 @@ void loop() {
 
     case STATE_RX:
       printfDebug("[FSM] STATE_RX: enabling LoRa receive...\n");
-      Radio.Rx(0);
+      startReceive();
       state = IDLE;
       break;
 
     case IDLE:
-      Radio.IrqProcess();
+      processRadioIrq();
+      if (!txBusy && sleepAllowed() && sleepDue(config.sleep_period_ms, config.sleep_window_ms, millis())) {
+        Radio.Sleep();
+        break;
+      }
+      // The duty-cycled receiver is asleep most of the time, its RSSI says nothing
+      if (!txBusy && !sleepAsleep && config.sniff_sleep_ms == 0 && noiseSampleDue(millis()))
+        noiseSample(Radio.Rssi(radioModem()));
+      // Flash writes stall the CPU and the UART interrupt, only batch them
+      // out while nothing is moving
+      if (!txBusy && !Serial.available() && !egressBusy())
+        traceService();
       break;
 
     default:
@@ -213,12 +520,21 @@ void loop() {
   }
 
   // Trigger TX if new RS485 data available
-  if (Serial.available()) {
+  if (serialFrameWaiting()) {
     state = STATE_TX;
   }
-  // Reset the device after 12 hours
-  if (millis() - bootTime >= RESET_INTERVAL_MS) {
-    Serial.println("[RESET] Restarting device...");
+  int8_t lbtPrev = lbtThreshold();
+  if (config.lbt_auto && noiseUpdate(millis(), config.lbt_margin)) {
+    printfDebug("[LBT] Noise floor %d dBm, threshold %d -> %d dBm\n", noiseFloor(), lbtPrev, noiseLbt);
+    traceEvent(TRACE_LBT_AUTO, (uint8_t)lbtPrev, 0, noiseFloor(), 0, (uint8_t)noiseLbt);
+  }
+
+  // Restart only when heap or stack stayed below their limits
+  if (healthCheck(millis())) {
+    Serial.printf("[RESET] Health limit crossed (heap %lu, block %lu, stack %lu), restarting...\n",
+                  healthLast.freeBytes, healthLast.largestBlock, healthLast.stackFree);
+    traceEvent(TRACE_RESTART, 1, 0, 0, 0, 0, millis() - bootTime);
+    traceFlush();
     delay(100);  // optional: allow serial message to send
     ESP.restart();
   }
@@ -229,31 +545,64 @@ void loop() {
 
 void OnTxDone(void) {
   printfDebug("[ISR] TX done.\n");
+  txBusy = false;
   memset(txpacket, 0, sizeof(txpacket));
   state = STATE_RX;
 }
 
 void OnTxTimeout(void) {
   printfDebug("[ISR] TX timeout.\n");
+  metrics.txTimeout++;
+  traceEvent(TRACE_TX_TIMEOUT);
+  txBusy = false;
   state = STATE_RX;
 }
 
 void OnRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr) {
-  rxSize = size;
   Rssi = rssi;
-
-  if (config.print_debug) {
-    rxpacket[size] = '\0';
-    printfDebug("[RX] Received from LoRa: %s\n", rxpacket);
-    printfDebug("[RX] RSSI: %d\n", rssi);
-    printfDebug("[RX] SNR: %d\n", snr);
-    delay(100);
+  metrics.airFramesRx++;
+  metrics.airBytesRx += size;
+  traceEvent(TRACE_RX, 0, size, rssi, snr);
+  sleepOnTraffic(millis());
+  // Duty-cycled RX stops after a frame
+  if (config.sniff_sleep_ms > 0)
+    startReceive();
+  metricsRecordLinear(histRssi, rssi, METRICS_RSSI_BASE, METRICS_RSSI_WIDTH);
+  metricsRecordLinear(histSnr, snr, METRICS_SNR_BASE, METRICS_SNR_WIDTH);
+  if (config.tdma_mode != TDMA_MODE_OFF) {
+    uint32_t airMs = Radio.TimeOnAir(radioModem(), size);
+    tdmaRecord(millis() - airMs, airMs, false);
   }
+  // Decode straight into a pool slot, the UART writes from there. With the
+  // pool full, control and mesh frames must still be handled, so decode into
+  // scratch and only drop a payload that needed a slot.
+  rx_slot_t *slot = rxPoolAcquire();
+  int decoded = linkDecode(payload, size, slot ? slot->data : rxScratch, rssi, snr);
+  if (decoded < 0) {
+    // Control frame or dropped delta, nothing to forward
+    state = STATE_TX;
+    return;
+  }
+  if (slot == NULL) {
+    rxPoolDrop();
+    printfDebug("[RX] All %d slots waiting for the UART, frame dropped.\n", RX_POOL_SLOTS);
+    state = STATE_TX;
+    return;
+  }
+  slot->rxDoneUs = rxTrace.rxDoneUs;
+  slot->readoutUs = tsRxReadout();
+  rxPoolCommit(slot, decoded, rssi, snr);
 
-  memcpy(rxpacket, payload, size);
-  rxRecieved = true;
-  //Serial.write((uint8_t *)rxpacket, size);
-  //memset(rxpacket, 0, sizeof(rxpacket));
+  printTextDebug("[RX] Received from LoRa: ", (const char *)slot->data, decoded);
+  printfDebug("[RX] RSSI: %d, SNR: %d\n", rssi, snr);
 
   state = STATE_TX;
 }
+
+void OnRxError(void) {
+  printfDebug("[ISR] RX CRC error.\n");
+  metrics.crcError++;
+  traceEvent(TRACE_CRC_ERROR);
+  if (config.sniff_sleep_ms > 0)
+    startReceive();
+}
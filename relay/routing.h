@@ -0,0 +1,148 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "settings.h"
+
+/*
+ * Address based routing between relays
+ *
+ * With routing enabled every frame starts with a two byte header:
+ *
+ *   [dst relay][src relay][link frame...]
+ *
+ * The head-end keeps a slave -> relay table and unicasts each request to the
+ * relay that owns the slave (Modbus slave id or M-Bus primary address).
+ * Entries are set with AT+ROUTE or learned from the source of responses.
+ * Field relays answer the relay that last addressed them. Frames for another
+ * relay are discarded after reading the header only.
+ */
+
+#define ROUTE_HDR_SIZE 2
+#define ROUTE_BROADCAST 0xFF
+#define ROUTE_SLAVES 256
+
+#define ROUTE_PROTO_MODBUS 0
+#define ROUTE_PROTO_MBUS 1
+
+#define MBUS_SHORT_START 0x10
+#define MBUS_LONG_START 0x68
+
+typedef struct
+{
+    uint32_t accepted;
+    uint32_t foreignDropped;
+    uint32_t learned;
+    uint32_t broadcastTx;
+} route_stats_t;
+
+static uint8_t routeTable[ROUTE_SLAVES];         // slave -> relay address
+static uint8_t routeStatic[ROUTE_SLAVES / 8];    // entries set by AT, never relearned
+static uint8_t routeOwned[ROUTE_SLAVES / 8];     // slaves on this relay's bus
+static uint8_t routeLastSrc = ROUTE_BROADCAST;
+static route_stats_t routeStats;
+
+static inline bool routeBit(const uint8_t *map, uint8_t slave)
+{
+    return map[slave >> 3] & (1 << (slave & 7));
+}
+
+static inline void routeSetBit(uint8_t *map, uint8_t slave, bool on)
+{
+    if (on)
+        map[slave >> 3] |= (1 << (slave & 7));
+    else
+        map[slave >> 3] &= ~(1 << (slave & 7));
+}
+
+void routeReset()
+{
+    memset(routeTable, ROUTE_BROADCAST, sizeof(routeTable));
+    memset(routeStatic, 0, sizeof(routeStatic));
+    memset(&routeStats, 0, sizeof(routeStats));
+    routeLastSrc = ROUTE_BROADCAST;
+}
+
+// Slave address carried by a bus frame, -1 when the frame has none
+int routeSlaveAddress(const uint8_t *frame, size_t len, uint8_t proto)
+{
+    if (proto == ROUTE_PROTO_MBUS)
+    {
+        if (len >= 6 && frame[0] == MBUS_LONG_START && frame[3] == MBUS_LONG_START)
+            return frame[5];
+        if (len >= 3 && frame[0] == MBUS_SHORT_START)
+            return frame[2];
+        return -1;
+    }
+    return len >= 1 ? frame[0] : -1;
+}
+
+bool routeOwns(uint8_t slave)
+{
+    return routeBit(routeOwned, slave);
+}
+
+bool routeHasOwned()
+{
+    for (size_t i = 0; i < sizeof(routeOwned); i++)
+        if (routeOwned[i])
+            return true;
+    return false;
+}
+
+void routeSetOwned(uint8_t slave, bool owned)
+{
+    routeSetBit(routeOwned, slave, owned);
+}
+
+void routeSetStatic(uint8_t slave, uint8_t relay)
+{
+    routeTable[slave] = relay;
+    routeSetBit(routeStatic, slave, relay != ROUTE_BROADCAST);
+}
+
+// Relay a frame read from our bus should be sent to
+uint8_t routeDestination(const uint8_t *frame, size_t len, uint8_t proto)
+{
+    int slave = routeSlaveAddress(frame, len, proto);
+    if (slave >= 0)
+    {
+        // Responses from our own slaves go back to whoever asked
+        if (routeOwns(slave) && routeLastSrc != ROUTE_BROADCAST)
+            return routeLastSrc;
+        if (routeTable[slave] != ROUTE_BROADCAST)
+            return routeTable[slave];
+    }
+    routeStats.broadcastTx++;
+    return ROUTE_BROADCAST;
+}
+
+// Header check done before the payload is read out of the radio
+bool routeAccepts(uint8_t dst, uint8_t self)
+{
+    return dst == self || dst == ROUTE_BROADCAST;
+}
+
+/*
+ * Bookkeeping for an accepted frame. Returns false when a broadcast frame
+ * addresses a slave that another relay owns and must not reach our bus.
+ */
+bool routeOnReceive(uint8_t src, const uint8_t *frame, size_t len, uint8_t proto, bool broadcast)
+{
+    int slave = routeSlaveAddress(frame, len, proto);
+    if (broadcast && slave >= 0 && routeHasOwned() && !routeOwns(slave))
+    {
+        routeStats.foreignDropped++;
+        return false;
+    }
+
+    routeStats.accepted++;
+    if (src == ROUTE_BROADCAST)
+        return true;
+    routeLastSrc = src;
+    if (slave >= 0 && !routeBit(routeStatic, slave) && routeTable[slave] != src)
+    {
+        routeTable[slave] = src;
+        routeStats.learned++;
+    }
+    return true;
+}
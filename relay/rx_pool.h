@@ -0,0 +1,93 @@
+#pragma once
+#include <stdint.h>
+#include "settings.h"
+
+/*
+ * Receive slot pool
+ *
+ * Frames from the air are decoded straight into one of RX_POOL_SLOTS fixed
+ * slots and written to the UART from there, so the radio payload is copied
+ * once on its way to the bus. Several frames can wait while the UART is
+ * still busy with an earlier one. When every slot is taken the frame is
+ * decoded into a scratch buffer instead, so link control, beacon and mesh
+ * frames are still handled; only a payload for the UART is dropped and
+ * counted with rxPoolDrop().
+ *
+ * The producer takes a slot with rxPoolAcquire() and hands it over with
+ * rxPoolCommit(). The consumer borrows the oldest frame with rxPoolPeek()
+ * and returns the slot with rxPoolRelease(). Radio callbacks run from
+ * Radio.IrqProcess() in loop(), so there is no concurrent access.
+ */
+
+typedef struct
+{
+    uint8_t data[LORA_BUFFER];
+    uint16_t len;
+    int16_t rssi;
+    int8_t snr;
+    int64_t rxDoneUs; // timestamps of this frame, see timestamps.h
+    int64_t readoutUs;
+} rx_slot_t;
+
+static rx_slot_t rxSlots[RX_POOL_SLOTS];
+static uint8_t rxReady[RX_POOL_SLOTS]; // slot indices, oldest first
+static uint8_t rxReadyHead = 0;
+static uint8_t rxReadyCount = 0;
+static uint32_t rxPoolFull = 0;
+static uint8_t rxPoolPeak = 0;
+static uint8_t rxScratch[LORA_BUFFER];
+
+static bool rxSlotQueued(uint8_t idx)
+{
+    for (uint8_t i = 0; i < rxReadyCount; i++)
+        if (rxReady[(rxReadyHead + i) % RX_POOL_SLOTS] == idx)
+            return true;
+    return false;
+}
+
+// Free slot to decode into, NULL when all are waiting for the UART. A slot
+// that is never committed simply stays free.
+rx_slot_t *rxPoolAcquire()
+{
+    for (uint8_t i = 0; i < RX_POOL_SLOTS; i++)
+    {
+        if (!rxSlotQueued(i))
+            return &rxSlots[i];
+    }
+    return NULL;
+}
+
+// A payload decoded without a slot that cannot reach the UART
+void rxPoolDrop()
+{
+    rxPoolFull++;
+}
+
+void rxPoolCommit(rx_slot_t *slot, uint16_t len, int16_t rssi, int8_t snr)
+{
+    slot->len = len;
+    slot->rssi = rssi;
+    slot->snr = snr;
+    rxReady[(rxReadyHead + rxReadyCount++) % RX_POOL_SLOTS] = slot - rxSlots;
+    if (rxReadyCount > rxPoolPeak)
+        rxPoolPeak = rxReadyCount;
+}
+
+// Oldest frame waiting for the UART, stays owned by the pool until released
+rx_slot_t *rxPoolPeek()
+{
+    return rxReadyCount ? &rxSlots[rxReady[rxReadyHead]] : NULL;
+}
+
+void rxPoolRelease()
+{
+    if (rxReadyCount == 0)
+        return;
+    rxReadyHead = (rxReadyHead + 1) % RX_POOL_SLOTS;
+    rxReadyCount--;
+}
+
+uint8_t rxPoolPending()
+{
+    return rxReadyCount;
+}
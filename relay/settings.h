@@ -2,8 +2,6 @@
 
 #define BP_VERSION "V1.1.4"
 
-//#define RESET_INTERVAL_MS (12UL * 60UL * 60UL * 1000UL)
-#define RESET_INTERVAL_MS (15UL * 60UL * 1000UL)
 #define BEACON_INTERVAL_MS (10UL * 60UL *1000UL)
 
 
@@ -23,9 +21,133 @@
 #define LORA_LBT_TIME 20  // Listen before talk time in ms
 #define LORA_LBT_RETRY 5  // Listen before talk retry count
 #define LORA_BUFFER 255 //< DO NOT CHANGE
+#define RX_POOL_SLOTS 4 // received frames that can wait for the UART
 #define LORA_TX_TIMEOUT 1000
+#define LORA_DIO1_PIN 3 // SX1262 DIO1 on HT-CT62
+
+// GFSK profile for short links (AT+MODEM=FSK)
+#define FSK_ENABLED false
+#define FSK_BITRATE 100000   // bps
+#define FSK_FDEV 50000       // Hz
+#define FSK_BANDWIDTH 234300 // Hz, RX filter, at least 2 * fdev + bitrate
+#define FSK_WHITENING true
+#define FSK_CRC true
+#define FSK_PREAMBLE_BYTES 5
 /*
 * Modbus/serial default settings
 */
 #define MODBUS_BD 9600
-#define MODBUS_READ_DELAY 100
\ No newline at end of file
+#define MODBUS_READ_DELAY 100
+#define UART_BUFFER_SIZE 1024    // TX ring
+#define UART_RX_BUFFER_SIZE 4096 // host data waiting for the air
+#define SERIAL_UART_NUM 0 // UART behind Serial
+#define RS485_MODE 0      // off, 1 DE/RE on RTS, 2 collision detect
+#define RS485_DE_PIN -1   // GPIO to the transceiver DE/RE, board specific
+
+// Serial back-pressure
+#define FLOW_MODE 0 // off
+#define FLOW_RTS_PIN -1
+#define FLOW_CTS_PIN -1
+#define FLOW_RTS_THRESHOLD 64  // RX FIFO bytes at which RTS stops the host
+#define FLOW_XOFF_THRESHOLD 96 // RX FIFO bytes at which XOFF is sent
+#define FLOW_XON_THRESHOLD 32  // RX FIFO bytes at which XON is sent
+
+// Fast boot from the RTC copy of the config after software resets
+#define FAST_BOOT false
+#define RTC_CONFIG_MAGIC 0x52434647 // "RCFG"
+
+// Warm sleep between polling windows, off with period 0
+#define SLEEP_PERIOD_MS 0
+#define SLEEP_WINDOW_MS 2000  // awake after the last frame
+#define SLEEP_WAKE_LEAD_MS 20 // wake this early before the expected poll
+#define SLEEP_MIN_MS 50       // shorter gaps are not worth sleeping
+
+// Duty-cycled RX, off with sleep 0
+#define SNIFF_SLEEP_MS 0      // our receiver's sleep between RX windows
+#define PEER_SNIFF_MS 0       // sleep period of the relays we send to
+#define SNIFF_MIN_SYMBOLS 8   // preamble symbols an RX window must see
+#define SNIFF_WAKE_US 1000    // SX1262 sleep to RX start-up
+#define SNIFF_ANNOUNCE_REPEATS 3        // announcements before we start sleeping
+#define SNIFF_ANNOUNCE_INTERVAL 60000UL // ms, repeated while sniffing for peers that missed it
+
+// Noise floor and auto LBT
+#define LBT_AUTO false
+#define LBT_MARGIN_DB 10      // auto threshold above the noise floor
+#define NOISE_SAMPLE_MS 100   // RSSI sample period while RX is idle
+#define NOISE_WINDOW 3000     // samples before the histogram is halved
+#define NOISE_MIN_SAMPLES 100 // before the first auto threshold
+#define NOISE_QUANTILE 20     // percentile taken as the floor
+#define NOISE_UPDATE_MS 10000
+#define NOISE_HYSTERESIS_DB 2
+#define NOISE_RSSI_MIN -140
+#define NOISE_RSSI_MAX -40
+#define NOISE_LBT_MIN -115    // auto threshold limits
+#define NOISE_LBT_MAX -60
+
+// Channel scan
+#define SCAN_FREQ_MIN 863000000
+#define SCAN_FREQ_MAX 870000000
+#define SCAN_STEP_HZ 200000
+#define SCAN_DWELL_MS 200
+#define SCAN_MAX_CHANNELS 64
+#define SCAN_SETTLE_US 500  // RX start-up before the first RSSI sample
+#define SCAN_SAMPLE_US 1000
+#define SCAN_ANNOUNCE_REPEATS 3
+#define SCAN_CONFIRM_MS 10000 // back to the old channel if no peer is heard on the new one
+#define SCAN_PROBE_MS 1000    // "here" frames on the new channel until a peer answers
+
+// Heap and stack health, restart only when a limit stays crossed
+#define HEALTH_CHECK_MS 1000
+#define HEALTH_TRIP_CHECKS 5
+#define HEALTH_MIN_FREE_HEAP 16384
+#define HEALTH_MIN_LARGEST_BLOCK 4096
+#define HEALTH_MIN_STACK 512
+
+// Persistent packet trace
+#define TRACE_ENABLED false
+#define TRACE_BATCH 32       // records held in RAM between flash writes
+#define TRACE_FLUSH_MS 5000  // max age of a batch before it is written
+#define TRACE_DUMP_BAUD 921600
+
+// Deferred debug log
+#define DEBUG_LOG_SERIAL Serial // port the log task renders to
+#define DEBUG_LOG_RECORDS 64
+#define DEBUG_LOG_STACK 3072
+#define DEBUG_LOG_PRIORITY 1
+#define DEBUG_LOG_POLL_MS 10
+
+/*
+* Link encoding defaults
+*/
+#define DELTA_ENABLED false
+#define LZ_ENABLED false
+#define DELTA_SLOTS 4            // Reference frames kept per direction (per sending relay on RX)
+#define DELTA_RX_PEERS 4         // Sending relays whose references are kept
+#define DELTA_RESYNC_INTERVAL 16 // Full frame every N frames per slot
+
+/*
+* Routing defaults
+*/
+#define ROUTING_ENABLED false
+#define RELAY_ADDRESS 1
+#define ROUTE_PROTOCOL 0 // 0 Modbus RTU, 1 M-Bus
+
+/*
+* Mesh defaults
+*/
+#define MESH_ENABLED false
+#define MESH_MAX_HOPS 3
+#define MESH_JITTER_MS 200                         // Max random delay before forwarding
+#define MESH_DUP_CACHE 32                          // Remembered (origin, seq) pairs
+#define MESH_ROUTES 16                             // Learned destinations
+#define MESH_FWD_QUEUE 2                           // Frames waiting to be forwarded
+#define MESH_ROUTE_TIMEOUT_MS (30UL * 60UL * 1000UL)
+#define MESH_SNR_HYSTERESIS 3                      // dB a new next hop must beat the old one by
+
+/*
+* TDMA defaults
+*/
+#define TDMA_MODE 0       // 0 off, 1 member, 2 head-end
+#define TDMA_MAX_SLOTS 8
+#define TDMA_GUARD_MS 20  // Added to every slot's time-on-air
+#define TDMA_SYNC_LOSS 3  // Superframes without beacon before falling back to LBT
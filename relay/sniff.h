@@ -0,0 +1,107 @@
+#pragma once
+#include <stdint.h>
+#include "settings.h"
+
+/*
+ * Duty-cycled RX (sniff mode)
+ *
+ * The receiver lets the SX1262 alternate between `sleep` ms asleep and a
+ * short RX window long enough to catch SNIFF_MIN_SYMBOLS preamble symbols
+ * (SetRxDutyCycle). A frame is only caught if its preamble spans a whole
+ * sleep period plus two windows, so senders talking to a sniffing relay
+ * stretch their preamble to that length. Every frame to it is delayed by
+ * roughly the sleep period, in exchange for the RX duty cycle.
+ *
+ * Times follow the LoRa symbol time 2^SF / BW of the current modem settings.
+ * The SX126x duty cycle timer counts in 15.625 us steps.
+ *
+ * With link framing the sleeping relay announces its period in a control
+ * frame (SNIFF_ANNOUNCE_REPEATS times before it starts to sleep, then every
+ * SNIFF_ANNOUNCE_INTERVAL) and senders take it as their peer period, so the
+ * two sides cannot stay mismatched. Last announcement wins, which fits a
+ * pair of relays; with several sleeping relays set AT+PEERSNIFF by hand.
+ */
+
+#define SNIFF_TICK_NS 15625
+
+static int32_t sniffPendingMs = -1;     // our own period, applied once announced
+static int32_t sniffPeerPendingMs = -1; // period announced by a peer
+static uint16_t sniffAnnounceMs = 0;
+static uint8_t sniffAnnounceLeft = 0;
+static unsigned long sniffAnnouncedAt = 0;
+
+// Announces `ms` to the peers, then switches our receiver to it
+void sniffAnnounce(uint16_t ms)
+{
+    sniffAnnounceMs = ms;
+    sniffAnnounceLeft = SNIFF_ANNOUNCE_REPEATS;
+}
+
+// Next announcement is due; while sniffing the period is re-announced every
+// interval. Without link framing a peer would pass the control frame on to
+// its bus, so nothing is announced and a pending change applies at once.
+bool sniffAnnounceDue(unsigned long now, uint16_t sleepMs, bool framing)
+{
+    if (!framing)
+    {
+        if (sniffAnnounceLeft > 0 && sniffAnnounceMs != sleepMs)
+            sniffPendingMs = sniffAnnounceMs;
+        sniffAnnounceLeft = 0;
+        return false;
+    }
+    if (sniffAnnounceLeft == 0)
+    {
+        if (sleepMs == 0 || now - sniffAnnouncedAt < SNIFF_ANNOUNCE_INTERVAL)
+            return false;
+        sniffAnnounceMs = sleepMs;
+        sniffAnnounceLeft = 1;
+    }
+    return true;
+}
+
+// Call once an announcement went out; after the last of a change our own
+// switch is queued. A busy channel or slot retries it.
+void sniffAnnounceSent(unsigned long now, uint16_t sleepMs)
+{
+    if (sniffAnnounceLeft > 0 && --sniffAnnounceLeft == 0 && sniffAnnounceMs != sleepMs)
+        sniffPendingMs = sniffAnnounceMs;
+    sniffAnnouncedAt = now;
+}
+
+static const uint32_t sniffBandwidthHz[] = {125000, 250000, 500000};
+
+uint32_t sniffSymbolUs(uint8_t sf, uint8_t bw)
+{
+    return (uint32_t)(((uint64_t)1000000 << sf) / sniffBandwidthHz[bw < 3 ? bw : 0]);
+}
+
+// RX window that still sees SNIFF_MIN_SYMBOLS of a preamble plus the wake-up time
+uint32_t sniffRxUs(uint8_t sf, uint8_t bw)
+{
+    return (SNIFF_MIN_SYMBOLS + 1) * sniffSymbolUs(sf, bw) + SNIFF_WAKE_US;
+}
+
+// Preamble in symbols a sender needs so a peer sleeping sleepMs catches it
+uint16_t sniffPreamble(uint16_t sleepMs, uint8_t sf, uint8_t bw, uint16_t minPreamble)
+{
+    if (sleepMs == 0)
+        return minPreamble;
+    uint32_t sym = sniffSymbolUs(sf, bw);
+    uint64_t needUs = (uint64_t)sleepMs * 1000 + 2 * sniffRxUs(sf, bw);
+    uint64_t symbols = (needUs + sym - 1) / sym;
+    if (symbols < minPreamble)
+        return minPreamble;
+    return symbols > 0xFFFF ? 0xFFFF : (uint16_t)symbols;
+}
+
+uint32_t sniffTicks(uint32_t us)
+{
+    return (uint32_t)((uint64_t)us * 1000 / SNIFF_TICK_NS);
+}
+
+// RX share of the duty cycle in hundredths of a percent
+uint32_t sniffDuty(uint16_t sleepMs, uint8_t sf, uint8_t bw)
+{
+    uint32_t rx = sniffRxUs(sf, bw);
+    return sleepMs ? (uint32_t)((uint64_t)rx * 10000 / (rx + (uint64_t)sleepMs * 1000)) : 10000;
+}
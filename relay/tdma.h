@@ -0,0 +1,215 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "settings.h"
+
+/*
+ * TDMA slot scheduling
+ *
+ * The head-end opens every superframe with a beacon carrying the slot table:
+ *
+ *   [beacon slot ms:2][slot count][owner][duration ms:2]...
+ *
+ * The superframe is the beacon slot followed by the slots in table order.
+ * Slot durations are sized on the head-end from the time-on-air of the
+ * frame size expected in them plus a guard time (see tdmaResize()). Members
+ * take the start of the superframe from the beacon RX time minus the beacon
+ * airtime and only transmit inside slots they own, without LBT. After TDMA_SYNC_LOSS missed
+ * beacons a member falls back to contention (LBT) until the next beacon.
+ */
+
+#define TDMA_MODE_OFF 0
+#define TDMA_MODE_MEMBER 1
+#define TDMA_MODE_HEADEND 2
+
+#define TDMA_BEACON_HDR_SIZE 3
+#define TDMA_SLOT_ENTRY_SIZE 3
+
+typedef struct
+{
+    uint8_t owner;
+    uint8_t expectedBytes; // head-end only, not sent in the beacon
+    uint16_t durationMs;
+} tdma_slot_t;
+
+typedef struct
+{
+    uint32_t txFrames;
+    uint32_t rxFrames;
+    uint32_t busyMs;
+} tdma_slot_stats_t;
+
+static tdma_slot_t tdmaSlots[TDMA_MAX_SLOTS];
+static tdma_slot_stats_t tdmaSlotStats[TDMA_MAX_SLOTS];
+static uint8_t tdmaSlotCount = 0;
+static uint16_t tdmaBeaconSlotMs = 0;
+static unsigned long tdmaFrameStart = 0;
+static bool tdmaSynced = false;
+static uint32_t tdmaSuperframes = 0;
+static uint32_t tdmaOutsideSlots = 0;
+
+uint32_t tdmaSuperframeMs()
+{
+    uint32_t total = tdmaBeaconSlotMs;
+    for (uint8_t i = 0; i < tdmaSlotCount; i++)
+        total += tdmaSlots[i].durationMs;
+    return total;
+}
+
+void tdmaResetStats()
+{
+    memset(tdmaSlotStats, 0, sizeof(tdmaSlotStats));
+    tdmaSuperframes = 0;
+    tdmaOutsideSlots = 0;
+}
+
+// Head-end: assigns slot `index` to `owner` for frames of up to `expectedBytes`
+void tdmaSetSlot(uint8_t index, uint8_t owner, uint8_t expectedBytes)
+{
+    if (index >= TDMA_MAX_SLOTS)
+        return;
+    tdmaSlots[index].owner = owner;
+    tdmaSlots[index].expectedBytes = expectedBytes;
+    if (index >= tdmaSlotCount)
+        tdmaSlotCount = index + 1;
+    // Clearing the last slots shortens the table
+    while (tdmaSlotCount > 0 && tdmaSlots[tdmaSlotCount - 1].expectedBytes == 0)
+        tdmaSlotCount--;
+}
+
+/*
+ * Head-end: sizes every slot and the beacon slot from time-on-air. airtime()
+ * returns the time-on-air in ms of a frame with the given air length.
+ */
+void tdmaResize(uint32_t (*airtime)(uint8_t), size_t overhead, size_t beaconAirLen, uint16_t guardMs)
+{
+    tdmaBeaconSlotMs = airtime(beaconAirLen) + guardMs;
+    for (uint8_t i = 0; i < tdmaSlotCount; i++)
+    {
+        size_t len = tdmaSlots[i].expectedBytes + overhead;
+        if (len > LORA_BUFFER)
+            len = LORA_BUFFER;
+        tdmaSlots[i].durationMs = tdmaSlots[i].expectedBytes ? airtime(len) + guardMs : 0;
+    }
+}
+
+size_t tdmaBeaconSize()
+{
+    return TDMA_BEACON_HDR_SIZE + tdmaSlotCount * TDMA_SLOT_ENTRY_SIZE;
+}
+
+size_t tdmaBuildBeacon(uint8_t *out)
+{
+    out[0] = tdmaBeaconSlotMs & 0xFF;
+    out[1] = tdmaBeaconSlotMs >> 8;
+    out[2] = tdmaSlotCount;
+    uint8_t *p = out + TDMA_BEACON_HDR_SIZE;
+    for (uint8_t i = 0; i < tdmaSlotCount; i++)
+    {
+        *p++ = tdmaSlots[i].owner;
+        *p++ = tdmaSlots[i].durationMs & 0xFF;
+        *p++ = tdmaSlots[i].durationMs >> 8;
+    }
+    return p - out;
+}
+
+// Head-end: a beacon went out at `now`, the new superframe starts with it
+void tdmaStartSuperframe(unsigned long now)
+{
+    tdmaFrameStart = now;
+    tdmaSynced = true;
+    tdmaSuperframes++;
+}
+
+// Member: adopt the slot table and re-anchor the superframe on the beacon
+bool tdmaOnBeacon(const uint8_t *in, size_t len, unsigned long frameStart)
+{
+    if (len < TDMA_BEACON_HDR_SIZE)
+        return false;
+    uint8_t count = in[2];
+    if (count > TDMA_MAX_SLOTS || len < (size_t)(TDMA_BEACON_HDR_SIZE + count * TDMA_SLOT_ENTRY_SIZE))
+        return false;
+
+    tdmaBeaconSlotMs = in[0] | (in[1] << 8);
+    tdmaSlotCount = count;
+    const uint8_t *p = in + TDMA_BEACON_HDR_SIZE;
+    for (uint8_t i = 0; i < count; i++, p += TDMA_SLOT_ENTRY_SIZE)
+    {
+        tdmaSlots[i].owner = p[0];
+        tdmaSlots[i].durationMs = p[1] | (p[2] << 8);
+    }
+    tdmaStartSuperframe(frameStart);
+    return true;
+}
+
+// Member: drop sync once several superframes passed without a beacon
+void tdmaCheckSync(unsigned long now)
+{
+    uint32_t period = tdmaSuperframeMs();
+    if (tdmaSynced && period > 0 && now - tdmaFrameStart > TDMA_SYNC_LOSS * period)
+        tdmaSynced = false;
+}
+
+/*
+ * Slot index active at `now`, -1 inside the beacon slot. Superframes repeat
+ * from the last beacon, so a late beacon does not stop members.
+ * *remainingMs is set to the time left in that slot.
+ */
+int tdmaSlotAt(unsigned long now, uint32_t *remainingMs)
+{
+    uint32_t offset = (now - tdmaFrameStart) % (tdmaSuperframeMs() ? tdmaSuperframeMs() : 1);
+    if (offset < tdmaBeaconSlotMs)
+        return -1;
+    offset -= tdmaBeaconSlotMs;
+    for (uint8_t i = 0; i < tdmaSlotCount; i++)
+    {
+        if (offset < tdmaSlots[i].durationMs)
+        {
+            if (remainingMs)
+                *remainingMs = tdmaSlots[i].durationMs - offset;
+            return i;
+        }
+        offset -= tdmaSlots[i].durationMs;
+    }
+    return -1;
+}
+
+// True when `self` owns the current slot and airMs still fits into it
+bool tdmaCanSend(uint8_t self, unsigned long now, uint32_t airMs)
+{
+    uint32_t remaining = 0;
+    int slot = tdmaSlotAt(now, &remaining);
+    return slot >= 0 && tdmaSlots[slot].owner == self && airMs <= remaining;
+}
+
+bool tdmaOwnsAnySlot(uint8_t self)
+{
+    for (uint8_t i = 0; i < tdmaSlotCount; i++)
+        if (tdmaSlots[i].owner == self && tdmaSlots[i].durationMs > 0)
+            return true;
+    return false;
+}
+
+// Accounts airtime to the slot a frame started in
+void tdmaRecord(unsigned long start, uint32_t airMs, bool tx)
+{
+    int slot = tdmaSlotAt(start, NULL);
+    if (slot < 0)
+    {
+        tdmaOutsideSlots++;
+        return;
+    }
+    tdma_slot_stats_t &s = tdmaSlotStats[slot];
+    if (tx)
+        s.txFrames++;
+    else
+        s.rxFrames++;
+    s.busyMs += airMs;
+}
+
+// Share of slot time carrying frames, in percent
+uint32_t tdmaUtilisation(uint8_t slot)
+{
+    uint64_t available = (uint64_t)tdmaSlots[slot].durationMs * tdmaSuperframes;
+    return available ? (uint32_t)((uint64_t)tdmaSlotStats[slot].busyMs * 100 / available) : 0;
+}
@@ -0,0 +1,217 @@
+#pragma once
+#include "Arduino.h"
+#include "esp_timer.h"
+#include "driver/sx126x.h"
+#include "metrics.h"
+
+/*
+ * Radio event timestamps and per-stage latency
+ *
+ * The DIO1 interrupt is hooked in front of the radio driver's own handler
+ * and captures esp_timer_get_time() on every rising edge. The ISR cannot
+ * talk SPI, so the edge time is attributed to the IRQ flags (TxDone, RxDone,
+ * PreambleDetected, HeaderValid) the next time loop() reads the IRQ status.
+ * DIO1 only rises again after the driver cleared the flags, so flags raised
+ * while it is still high share the earlier edge time.
+ *
+ * Timestamps travel with each frame: a serial frame held for its TDMA slot
+ * keeps its own tx_trace_t, a received frame waiting in the RX pool keeps
+ * its RX done and readout times in its rx_slot_t. Only the frame on air in
+ * each direction is traced globally. Control frames are not traced. Stage
+ * durations are accumulated in fixed counters.
+ */
+
+#define TS_NONE 0
+
+enum
+{
+    STAGE_UART_GATHER, // first serial byte -> frame complete
+    STAGE_LBT,         // frame complete -> handed to the radio
+    STAGE_AIR_TX,      // handed to the radio -> TxDone
+    STAGE_AIR_RX,      // PreambleDetected -> RxDone
+    STAGE_RX_READOUT,  // RxDone -> payload decoded
+    STAGE_UART_DRAIN,  // payload decoded -> last stop bit on the bus
+    STAGE_COUNT
+};
+
+static const char *stageNames[STAGE_COUNT] = {"uart_gather", "lbt", "air_tx", "air_rx", "rx_readout", "uart_drain"};
+
+typedef struct
+{
+    int64_t uartFirstUs;
+    int64_t uartGatheredUs;
+    int64_t txStartUs;
+    int64_t txDoneUs;
+} tx_trace_t;
+
+typedef struct
+{
+    int64_t preambleUs;
+    int64_t headerUs;
+    int64_t rxDoneUs;
+} rx_trace_t;
+
+typedef struct
+{
+    uint32_t count;
+    uint64_t sumUs;
+    uint32_t maxUs;
+    uint32_t lastUs;
+} stage_stat_t;
+
+// Boot milestones, esp_timer time since the application started
+enum
+{
+    BOOT_SETUP,        // setup() entered
+    BOOT_CONFIG,       // config restored, serial at bus baud rate
+    BOOT_MCU,          // Mcu.begin() done
+    BOOT_RADIO_INIT,   // Radio.Init() done
+    BOOT_RADIO_CONFIG, // modem settings and channel applied
+    BOOT_RX_ARMED,     // listening
+    BOOT_DONE,         // deferred init finished
+    BOOT_COUNT
+};
+
+static const char *bootStageNames[BOOT_COUNT] = {"setup", "config", "mcu", "radio_init", "radio_config", "rx_armed", "done"};
+static int64_t bootStageUs[BOOT_COUNT];
+static bool bootWarm = false;
+
+static volatile int64_t tsIsrUs = TS_NONE;
+static volatile bool tsIsrPending = false;
+static tx_trace_t txTrace;  // serial frame being gathered
+static tx_trace_t txAir;    // data frame on air, taken over by tsTxStart()
+static bool txAirData = false;
+static rx_trace_t rxTrace;  // frame being received
+static int64_t egressRxDoneUs = TS_NONE; // last frame handed to the UART
+static int64_t egressReadoutUs = TS_NONE;
+static stage_stat_t stageStats[STAGE_COUNT];
+
+// Radio driver's DIO1 handler, chained from ours. It lives in the Heltec
+// radio.c, built as C. The driver attaches this same function to DIO1 itself
+// (SX126xIoIrqInit), so it already runs from the Arduino GPIO ISR service
+// and is placed for that; chaining it does not add a flash call the driver
+// did not have. It only flags the IRQ for Radio.IrqProcess().
+extern "C" void RadioOnDioIrq(void);
+
+void IRAM_ATTR onDio1Isr()
+{
+    if (!tsIsrPending)
+    {
+        tsIsrUs = esp_timer_get_time();
+        tsIsrPending = true;
+    }
+    RadioOnDioIrq();
+}
+
+void tsBoot(uint8_t stage)
+{
+    bootStageUs[stage] = esp_timer_get_time();
+}
+
+void tsStage(uint8_t stage, int64_t startUs, int64_t endUs)
+{
+    if (startUs == TS_NONE || endUs == TS_NONE || endUs < startUs)
+        return;
+    uint32_t us = (uint32_t)(endUs - startUs);
+    stage_stat_t &s = stageStats[stage];
+    s.count++;
+    s.sumUs += us;
+    s.lastUs = us;
+    if (us > s.maxUs)
+        s.maxUs = us;
+}
+
+// Attributes the pending DIO1 edge to the IRQ flags currently raised
+void tsOnIrqStatus(uint16_t irq)
+{
+    if (!tsIsrPending)
+        return;
+    int64_t us = tsIsrUs;
+    tsIsrPending = false;
+
+    if (irq & IRQ_PREAMBLE_DETECTED)
+    {
+        rxTrace = {};
+        rxTrace.preambleUs = us;
+    }
+    // Sync word stands in for the header in GFSK
+    if (irq & (IRQ_HEADER_VALID | IRQ_SYNCWORD_VALID))
+        rxTrace.headerUs = us;
+    if (irq & IRQ_RX_DONE)
+    {
+        rxTrace.rxDoneUs = us;
+        tsStage(STAGE_AIR_RX, rxTrace.preambleUs, us);
+    }
+    // Control frames, beacons and forwards have no trace
+    if ((irq & IRQ_TX_DONE) && txAirData)
+    {
+        txAirData = false;
+        txAir.txDoneUs = us;
+        tsStage(STAGE_AIR_TX, txAir.txStartUs, us);
+        if (txAir.uartFirstUs != TS_NONE)
+            metricsRecordLog(histSerialToAir, (uint32_t)(us - txAir.uartFirstUs));
+    }
+}
+
+void tsUartFirstByte()
+{
+    txTrace = {};
+    txTrace.uartFirstUs = esp_timer_get_time();
+}
+
+void tsUartGathered()
+{
+    txTrace.uartGatheredUs = esp_timer_get_time();
+    tsStage(STAGE_UART_GATHER, txTrace.uartFirstUs, txTrace.uartGatheredUs);
+}
+
+// Data frame traced by `t` has just been handed to the radio
+void tsTxStart(const tx_trace_t &t)
+{
+    txAir = t;
+    txAir.txStartUs = esp_timer_get_time();
+    txAirData = true;
+    tsStage(STAGE_LBT, txAir.uartGatheredUs, txAir.txStartUs);
+    if (txAir.uartGatheredUs != TS_NONE)
+        metricsRecordLog(histLbtWait, (uint32_t)(txAir.txStartUs - txAir.uartGatheredUs));
+}
+
+// Payload of the frame being received is decoded, returns the time for its slot
+int64_t tsRxReadout()
+{
+    int64_t us = esp_timer_get_time();
+    tsStage(STAGE_RX_READOUT, rxTrace.rxDoneUs, us);
+    return us;
+}
+
+// Frame received at rxDoneUs / decoded at readoutUs was handed to the UART.
+// Several frames can drain in one go; the drain time is only known for the last.
+void tsUartQueued(int64_t rxDoneUs, int64_t readoutUs)
+{
+    egressRxDoneUs = rxDoneUs;
+    egressReadoutUs = readoutUs;
+}
+
+// Last stop bit of the last queued frame has left the UART
+void tsUartDrained()
+{
+    int64_t us = esp_timer_get_time();
+    tsStage(STAGE_UART_DRAIN, egressReadoutUs, us);
+    if (egressRxDoneUs != TS_NONE)
+        metricsRecordLog(histAirToSerial, (uint32_t)(us - egressRxDoneUs));
+    egressRxDoneUs = TS_NONE;
+    egressReadoutUs = TS_NONE;
+}
+
+// RX done time of the frame being handled in ms, `fallbackMs` without a fresh capture
+unsigned long tsLastRxDoneMs(unsigned long fallbackMs)
+{
+    if (rxTrace.rxDoneUs == TS_NONE || esp_timer_get_time() - rxTrace.rxDoneUs > 1000000LL)
+        return fallbackMs;
+    return (unsigned long)(rxTrace.rxDoneUs / 1000);
+}
+
+void tsReset()
+{
+    memset(stageStats, 0, sizeof(stageStats));
+}
@@ -0,0 +1,238 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "Arduino.h"
+#include "esp_partition.h"
+#include "settings.h"
+
+/*
+ * Persistent packet trace
+ *
+ * Events are 16 byte records collected in RAM and appended in batches to the
+ * "trace" data partition (see partitions.csv). The partition is used as a
+ * ring of 4 KiB sectors, each starting with a header:
+ *
+ *   [magic:4][sector seq:4][reserved:8][record]...[record]
+ *
+ * Records are only ever appended into erased flash, a sector is erased when
+ * the write position wraps onto it, so every sector sees the same number of
+ * erase cycles. On boot the sector with the highest seq is found and writing
+ * continues after its last record. Unwritten records read as 0xFF.
+ *
+ * Times are ms since boot, each boot starts with a TRACE_BOOT record.
+ * tools/trace_decode.py turns a dump into a timeline.
+ */
+
+#define TRACE_SECTOR_SIZE 4096
+#define TRACE_HDR_SIZE 16
+#define TRACE_RECORD_SIZE 16
+#define TRACE_PER_SECTOR ((TRACE_SECTOR_SIZE - TRACE_HDR_SIZE) / TRACE_RECORD_SIZE)
+#define TRACE_MAGIC 0x31435254 // "TRC1"
+#define TRACE_SUBTYPE 0x40
+#define TRACE_EMPTY 0xFF
+
+enum
+{
+    TRACE_BOOT = 1,    // a: reset reason
+    TRACE_TX,          // len, d: airtime ms
+    TRACE_RX,          // len, rssi, snr
+    TRACE_STATE,       // a: old state, b: new state
+    TRACE_LBT_FAIL,    // len, rssi: last channel RSSI
+    TRACE_TX_TIMEOUT,  //
+    TRACE_CRC_ERROR,   //
+    TRACE_RESTART,     // d: uptime ms, a: 1 after a failed health check
+    TRACE_DROPPED,     // d: records lost while the RAM batch was full
+    TRACE_LBT_AUTO,    // rssi: noise floor, a: old threshold, b: new threshold (int8)
+};
+
+typedef struct __attribute__((packed))
+{
+    uint32_t ms;
+    uint8_t type;
+    uint8_t a;
+    uint16_t len;
+    int16_t rssi;
+    int8_t snr;
+    uint8_t b;
+    uint32_t d;
+} trace_record_t;
+
+static_assert(sizeof(trace_record_t) == TRACE_RECORD_SIZE, "trace record size");
+
+static bool traceEnabled = TRACE_ENABLED;
+static const esp_partition_t *tracePart = NULL;
+static uint32_t traceSectors = 0;
+static uint32_t traceSector = 0; // sector being appended to
+static uint32_t traceSeq = 0;    // its seq
+static uint32_t traceIndex = 0;  // next free record in it
+static trace_record_t traceBatch[TRACE_BATCH];
+static uint8_t traceBatchLen = 0;
+static uint32_t traceDropped = 0;
+static unsigned long traceLastFlush = 0;
+
+static uint32_t traceSectorOffset(uint32_t sector)
+{
+    return sector * TRACE_SECTOR_SIZE;
+}
+
+static void traceOpenSector(uint32_t sector, uint32_t seq)
+{
+    uint32_t hdr[TRACE_HDR_SIZE / 4] = {TRACE_MAGIC, seq, 0xFFFFFFFF, 0xFFFFFFFF};
+    esp_partition_erase_range(tracePart, traceSectorOffset(sector), TRACE_SECTOR_SIZE);
+    esp_partition_write(tracePart, traceSectorOffset(sector), hdr, sizeof(hdr));
+    traceSector = sector;
+    traceSeq = seq;
+    traceIndex = 0;
+}
+
+// Finds the newest sector and the first free record in it
+bool traceBegin()
+{
+    tracePart = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)TRACE_SUBTYPE, "trace");
+    if (!tracePart)
+        return false;
+    traceSectors = tracePart->size / TRACE_SECTOR_SIZE;
+
+    bool found = false;
+    for (uint32_t s = 0; s < traceSectors; s++)
+    {
+        uint32_t hdr[2];
+        esp_partition_read(tracePart, traceSectorOffset(s), hdr, sizeof(hdr));
+        if (hdr[0] == TRACE_MAGIC && (!found || (int32_t)(hdr[1] - traceSeq) > 0))
+        {
+            found = true;
+            traceSector = s;
+            traceSeq = hdr[1];
+        }
+    }
+    if (!found)
+    {
+        traceOpenSector(0, 0);
+        return true;
+    }
+
+    // Binary search for the first erased record, records are appended in order
+    uint32_t lo = 0, hi = TRACE_PER_SECTOR;
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        uint8_t type;
+        esp_partition_read(tracePart, traceSectorOffset(traceSector) + TRACE_HDR_SIZE + mid * TRACE_RECORD_SIZE + 4, &type, 1);
+        if (type == TRACE_EMPTY)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    traceIndex = lo;
+    return true;
+}
+
+void traceEvent(uint8_t type, uint8_t a = 0, uint16_t len = 0, int16_t rssi = 0, int8_t snr = 0, uint8_t b = 0, uint32_t d = 0)
+{
+    if (!traceEnabled || !tracePart)
+        return;
+    if (traceBatchLen >= TRACE_BATCH)
+    {
+        traceDropped++;
+        return;
+    }
+    trace_record_t &r = traceBatch[traceBatchLen++];
+    r.ms = millis();
+    r.type = type;
+    r.a = a;
+    r.len = len;
+    r.rssi = rssi;
+    r.snr = snr;
+    r.b = b;
+    r.d = d;
+}
+
+// Appends the RAM batch to flash, opening (erasing) the next sector as needed
+void traceFlush()
+{
+    if (!tracePart)
+        return;
+    if (traceDropped && traceBatchLen < TRACE_BATCH)
+    {
+        traceBatchLen++;
+        traceBatch[traceBatchLen - 1] = {(uint32_t)millis(), TRACE_DROPPED, 0, 0, 0, 0, 0, traceDropped};
+        traceDropped = 0;
+    }
+    uint8_t done = 0;
+    while (done < traceBatchLen)
+    {
+        if (traceIndex >= TRACE_PER_SECTOR)
+            traceOpenSector((traceSector + 1) % traceSectors, traceSeq + 1);
+        uint32_t n = traceBatchLen - done;
+        if (n > TRACE_PER_SECTOR - traceIndex)
+            n = TRACE_PER_SECTOR - traceIndex;
+        uint32_t offset = traceSectorOffset(traceSector) + TRACE_HDR_SIZE + traceIndex * TRACE_RECORD_SIZE;
+        esp_partition_write(tracePart, offset, &traceBatch[done], n * TRACE_RECORD_SIZE);
+        traceIndex += n;
+        done += n;
+    }
+    traceBatchLen = 0;
+    traceLastFlush = millis();
+}
+
+// Flushes once the batch is half full or has aged; call when the relay is idle
+void traceService()
+{
+    if (traceBatchLen == 0)
+        return;
+    if (traceBatchLen >= TRACE_BATCH / 2 || millis() - traceLastFlush >= TRACE_FLUSH_MS)
+        traceFlush();
+}
+
+void traceErase()
+{
+    if (!tracePart)
+        return;
+    traceBatchLen = 0;
+    traceDropped = 0;
+    esp_partition_erase_range(tracePart, 0, tracePart->size);
+    traceOpenSector(0, 0);
+}
+
+/*
+ * Streams every valid sector, oldest first, as raw binary:
+ *
+ *   TRACE,<sectors>,<sector size>\n<sectors * sector size bytes>
+ *
+ * idle() is called after each chunk so the caller can feed the watchdog.
+ */
+void traceDump(Print &out, void (*idle)())
+{
+    if (!tracePart)
+    {
+        out.printf("TRACE,0,%u\n", TRACE_SECTOR_SIZE);
+        return;
+    }
+    traceFlush();
+    uint32_t valid = 0;
+    for (uint32_t s = 0; s < traceSectors; s++)
+    {
+        uint32_t magic;
+        esp_partition_read(tracePart, traceSectorOffset(s), &magic, sizeof(magic));
+        if (magic == TRACE_MAGIC)
+            valid++;
+    }
+    out.printf("TRACE,%lu,%u\n", valid, TRACE_SECTOR_SIZE);
+
+    static uint8_t chunk[256];
+    for (uint32_t i = 1; i <= traceSectors; i++)
+    {
+        uint32_t s = (traceSector + i) % traceSectors;
+        uint32_t magic;
+        esp_partition_read(tracePart, traceSectorOffset(s), &magic, sizeof(magic));
+        if (magic != TRACE_MAGIC)
+            continue;
+        for (uint32_t o = 0; o < TRACE_SECTOR_SIZE; o += sizeof(chunk))
+        {
+            esp_partition_read(tracePart, traceSectorOffset(s) + o, chunk, sizeof(chunk));
+            out.write(chunk, sizeof(chunk));
+            idle();
+        }
+    }
+    out.flush();
+}
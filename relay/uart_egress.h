@@ -0,0 +1,162 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include "Arduino.h"
+#include "driver/uart.h"
+#include "settings.h"
+
+/*
+ * UART egress
+ *
+ * Frames from the air go into the UART driver's TX ring buffer
+ * (UART_BUFFER_SIZE); its interrupt feeds the hardware FIFO while loop()
+ * keeps servicing the radio. A frame is only handed over once the ring has
+ * room for all of it, so Serial.write() never blocks; until then the frame
+ * waits in its receive slot.
+ *
+ * egressDone() reports once when the last stop bit has left the UART
+ * (driver TX done), which is the end of the air-to-serial latency and the
+ * point where the bus can turn around.
+ *
+ * RS485 has two modes:
+ *
+ * - RS485_DE: UART_MODE_RS485_HALF_DUPLEX. The driver asserts RTS, wired to
+ *   the transceiver's DE/RE, when a write starts and releases it from the
+ *   TX done interrupt. The receiver is off while we send, so there is no
+ *   echo and no collision detection in this mode.
+ * - RS485_ECHO: UART_MODE_RS485_COLLISION_DETECT, for transceivers that
+ *   switch direction by themselves and keep the receiver on. The UART reads
+ *   back its own bytes and raises a clash interrupt when the echo differs;
+ *   the driver's flag is counted per drained frame. The echo also lands in
+ *   the RX ring and would be taken for host data, so as many bytes as were
+ *   written are read back and dropped (egressEchoPending()), giving up
+ *   EGRESS_ECHO_MS after the last stop bit. AT replies are not counted and
+ *   are followed by egressDropEcho() instead.
+ *
+ * The UART interrupt runs from flash unless the core was built with
+ * CONFIG_UART_ISR_IN_IRAM (the stock Arduino core is not). It is then held
+ * off during every flash write, which delays the DE release and can starve
+ * the TX FIFO mid-frame, so flash writes wait for egressBusy() to clear.
+ */
+
+#define RS485_OFF 0
+#define RS485_DE 1
+#define RS485_ECHO 2
+#define EGRESS_ECHO_MS 20 // echo still arriving after the last stop bit
+
+typedef struct
+{
+    uint32_t frames;
+    uint32_t deferred; // frames that had to wait for ring space
+    uint32_t drains;   // times the UART ran empty
+    uint32_t collisions;
+    uint32_t echoLost; // bytes of echo that never came back
+} egress_stats_t;
+
+static egress_stats_t egressStats;
+static bool egressDraining = false;
+static bool egressWaiting = false;
+static uint8_t egressRs485 = RS485_OFF;
+static std::atomic<uint32_t> egressEchoLeft(0); // the log task adds to it
+static unsigned long egressEchoDeadline = 0;
+
+// RS485 in the given mode, dePin only for RS485_DE; plain UART when off
+bool rs485Apply(uint8_t mode, int8_t dePin)
+{
+    egressRs485 = RS485_OFF;
+    egressEchoLeft = 0;
+    if (mode == RS485_OFF)
+        return Serial.setMode(UART_MODE_UART);
+    if (mode == RS485_DE &&
+        (dePin < 0 || !Serial.setPins(-1, -1, -1, dePin) || !Serial.setMode(UART_MODE_RS485_HALF_DUPLEX)))
+        return false;
+    if (mode == RS485_ECHO && !Serial.setMode(UART_MODE_RS485_COLLISION_DETECT))
+        return false;
+    egressRs485 = mode;
+    return true;
+}
+
+// `len` bytes written to the bus will come back as echo, call under the bus lock
+void egressEchoExpect(size_t len)
+{
+    if (egressRs485 == RS485_ECHO)
+        egressEchoLeft += len;
+}
+
+// Drops echo that has arrived, true while more is expected. Host data must
+// not be read before this returns false.
+bool egressEchoPending()
+{
+    while (egressEchoLeft > 0 && Serial.available())
+    {
+        Serial.read();
+        egressEchoLeft--;
+    }
+    if (egressEchoLeft == 0)
+        return false;
+    // The deadline runs from the last stop bit
+    if (uart_wait_tx_done(SERIAL_UART_NUM, 0) != ESP_OK)
+    {
+        egressEchoDeadline = millis() + EGRESS_ECHO_MS;
+    }
+    else if ((long)(millis() - egressEchoDeadline) >= 0)
+    {
+        egressStats.echoLost += egressEchoLeft;
+        egressEchoLeft = 0;
+    }
+    return egressEchoLeft > 0;
+}
+
+// For output whose length is not counted (AT replies): wait for all of it
+// to leave, then drop whatever came back. The host is waiting for the reply,
+// so nothing of its own is on the bus yet. Call under the bus lock.
+void egressDropEcho()
+{
+    if (egressRs485 != RS485_ECHO)
+        return;
+    Serial.flush();
+    delay(EGRESS_ECHO_MS);
+    uart_flush_input(SERIAL_UART_NUM);
+    egressEchoLeft = 0;
+}
+
+// Queues the frame, false while the ring has no room for it yet
+bool egressWrite(const uint8_t *data, size_t len)
+{
+    if ((size_t)Serial.availableForWrite() < len)
+    {
+        if (!egressWaiting)
+            egressStats.deferred++;
+        egressWaiting = true;
+        return false;
+    }
+    Serial.write(data, len);
+    egressEchoExpect(len);
+    egressWaiting = false;
+    egressDraining = true;
+    egressStats.frames++;
+    return true;
+}
+
+// True once after everything queued has left the UART
+bool egressDone()
+{
+    if (!egressDraining || uart_wait_tx_done(SERIAL_UART_NUM, 0) != ESP_OK)
+        return false;
+    egressDraining = false;
+    egressStats.drains++;
+    bool collision = false;
+    if (egressRs485 == RS485_ECHO && uart_get_collision_flag(SERIAL_UART_NUM, &collision) == ESP_OK && collision)
+    {
+        egressStats.collisions++;
+        // The flag is sticky, setting the mode again is the only way to clear it
+        uart_set_mode(SERIAL_UART_NUM, UART_MODE_RS485_COLLISION_DETECT);
+    }
+    return true;
+}
+
+// A frame is queued or still leaving the UART
+bool egressBusy()
+{
+    return egressDraining || egressWaiting;
+}
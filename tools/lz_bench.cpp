@@ -0,0 +1,140 @@
+/*
+ * Host-side benchmark of the relay LZ compression stage.
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -I relay tools/lz_bench.cpp -o lz_bench
+ *   ./lz_bench [traffic.txt]
+ *
+ * The traffic file holds one frame per line, either as hex bytes
+ * ("01 03 00 00 00 0A C5 CD" or test_sender.py's "0x01 0x03 ...") or as
+ * plain text, which is sent with its trailing newline. Without a file a
+ * built-in sample of beacon and Modbus traffic is used.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "lz_codec.h"
+
+typedef std::vector<uint8_t> frame_t;
+
+static const char *samples[] = {
+    "BEACON: Device [a4:cf:12:9b:3e:10] alive at 600021 ms",
+    "BEACON: Device [a4:cf:12:9b:3e:10] alive at 1200043 ms",
+    "[NODE01] DATA [0001]",
+    "[NODE01] DATA [0002] XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX",
+    "01 03 00 00 00 0A C5 CD",
+    "01 03 14 00 E6 00 E5 00 E7 01 F4 00 00 00 00 13 88 00 00 00 64 00 01 2B 5E",
+    "68 1F 1F 68 08 01 72 45 23 11 70 24 40 01 07 55 00 00 00 0C 13 27 04 85 02 04 6D 32 37 1F 15 02 FD 17 00 00 89 16",
+};
+
+static bool parseHex(const std::string &line, frame_t &out)
+{
+    out.clear();
+    size_t i = 0;
+    while (i < line.size())
+    {
+        while (i < line.size() && isspace((unsigned char)line[i]))
+            i++;
+        if (i >= line.size())
+            break;
+        if (line.compare(i, 2, "0x") == 0 || line.compare(i, 2, "0X") == 0)
+            i += 2;
+        if (i + 1 >= line.size() || !isxdigit((unsigned char)line[i]) || !isxdigit((unsigned char)line[i + 1]))
+            return false;
+        if (i + 2 < line.size() && !isspace((unsigned char)line[i + 2]))
+            return false;
+        out.push_back((uint8_t)strtoul(line.substr(i, 2).c_str(), NULL, 16));
+        i += 2;
+    }
+    return !out.empty();
+}
+
+static void addFrame(std::vector<frame_t> &frames, const std::string &line)
+{
+    frame_t f;
+    if (!parseHex(line, f))
+    {
+        f.assign(line.begin(), line.end());
+        f.push_back('\n');
+    }
+    if (f.size() > LORA_BUFFER - 1)
+        f.resize(LORA_BUFFER - 1);
+    frames.push_back(f);
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<frame_t> frames;
+    if (argc > 1)
+    {
+        FILE *fp = fopen(argv[1], "r");
+        if (!fp)
+        {
+            perror(argv[1]);
+            return 1;
+        }
+        char buf[1024];
+        while (fgets(buf, sizeof(buf), fp))
+        {
+            std::string line(buf);
+            while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+                line.pop_back();
+            if (!line.empty())
+                addFrame(frames, line);
+        }
+        fclose(fp);
+    }
+    else
+    {
+        for (const char *s : samples)
+            addFrame(frames, s);
+    }
+
+    const int rounds = 1000;
+    size_t inBytes = 0, outBytes = 0, compressed = 0;
+    double compressUs = 0, decompressUs = 0;
+    uint8_t packed[LORA_BUFFER], unpacked[LORA_BUFFER];
+
+    printf("%-6s %-6s %-6s %-8s\n", "frame", "in", "out", "ratio");
+    for (size_t f = 0; f < frames.size(); f++)
+    {
+        const frame_t &fr = frames[f];
+        size_t n = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++)
+            n = lzCompress(fr.data(), fr.size(), packed, sizeof(packed));
+        auto t1 = std::chrono::steady_clock::now();
+        compressUs += std::chrono::duration<double, std::micro>(t1 - t0).count() / rounds;
+
+        size_t out = n ? n : fr.size();
+        if (n)
+        {
+            int m = 0;
+            t0 = std::chrono::steady_clock::now();
+            for (int r = 0; r < rounds; r++)
+                m = lzDecompress(packed, n, unpacked, sizeof(unpacked));
+            t1 = std::chrono::steady_clock::now();
+            decompressUs += std::chrono::duration<double, std::micro>(t1 - t0).count() / rounds;
+            if (m != (int)fr.size() || memcmp(unpacked, fr.data(), m) != 0)
+            {
+                printf("frame %zu: round trip mismatch\n", f);
+                return 1;
+            }
+            compressed++;
+        }
+
+        inBytes += fr.size();
+        outBytes += out + 1; // flags byte
+        printf("%-6zu %-6zu %-6zu %.2f\n", f, fr.size(), out + 1, (double)fr.size() / (out + 1));
+    }
+
+    printf("\nframes=%zu compressed=%zu in=%zu out=%zu ratio=%.2f\n",
+           frames.size(), compressed, inBytes, outBytes, outBytes ? (double)inBytes / outBytes : 0.0);
+    printf("compress=%.2f us/frame decompress=%.2f us/frame (host)\n",
+           compressUs / frames.size(), compressed ? decompressUs / compressed : 0.0);
+    return 0;
+}
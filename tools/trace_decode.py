@@ -0,0 +1,104 @@
+import argparse
+import struct
+import sys
+import time
+
+# Decodes the packet trace written by relay/trace_log.h into a timeline.
+#
+#   python tools/trace_decode.py -p /dev/ttyUSB0 -b 9600 -o trace.bin   # dump over AT+TRACEDUMP
+#   python tools/trace_decode.py -f trace.bin                           # decode a saved dump
+
+parser = argparse.ArgumentParser(description="Relay packet trace dump and decoder.")
+parser.add_argument('-p', '--port', type=str, help='Serial port of the relay (e.g., /dev/ttyUSB0 or COM3)')
+parser.add_argument('-b', '--baudrate', type=int, default=9600, help='Current relay baud rate')
+parser.add_argument('-d', '--dump-baud', type=int, default=921600, help='Baud rate used for the dump')
+parser.add_argument('-f', '--file', type=str, help='Decode a saved dump instead of reading the relay')
+parser.add_argument('-o', '--output', type=str, help='Save the raw dump to this file')
+args = parser.parse_args()
+
+SECTOR_MAGIC = 0x31435254
+HDR_SIZE = 16
+RECORD = struct.Struct('<IBBHhbBI')
+
+RESET_REASONS = ['unknown', 'power-on', 'ext', 'sw', 'panic', 'int-wdt', 'task-wdt', 'wdt',
+                 'deepsleep', 'brownout', 'sdio']
+STATES = ['IDLE', 'STATE_RX', 'STATE_TX']
+
+
+def read_dump():
+    import serial
+    with serial.Serial(args.port, args.baudrate, timeout=2) as ser:
+        ser.reset_input_buffer()
+        ser.write(f"AT+TRACEDUMP={args.dump_baud}\r\n".encode())
+        line = b''
+        while not line.startswith(b'BAUD,'):
+            line = ser.readline()
+            if not line:
+                sys.exit("No answer to AT+TRACEDUMP")
+        ser.baudrate = args.dump_baud
+        line = ser.readline()
+        if not line.startswith(b'TRACE,'):
+            sys.exit(f"Unexpected dump header: {line!r}")
+        sectors, size = (int(x) for x in line.decode().strip().split(',')[1:3])
+        data = ser.read(sectors * size)
+        if len(data) != sectors * size:
+            sys.exit(f"Short dump: {len(data)} of {sectors * size} bytes")
+        time.sleep(0.3)
+        ser.baudrate = args.baudrate
+        return data, size
+
+
+def describe(kind, a, length, rssi, snr, b, d):
+    if kind == 1:
+        reason = RESET_REASONS[a] if a < len(RESET_REASONS) else str(a)
+        return f"BOOT reset={reason}"
+    if kind == 2:
+        return f"TX len={length} air={d}ms"
+    if kind == 3:
+        return f"RX len={length} rssi={rssi} snr={snr}"
+    if kind == 4:
+        old = STATES[a] if a < len(STATES) else a
+        new = STATES[b] if b < len(STATES) else b
+        return f"STATE {old} -> {new}"
+    if kind == 5:
+        return f"LBT_FAIL len={length} rssi={rssi}"
+    if kind == 6:
+        return "TX_TIMEOUT"
+    if kind == 7:
+        return "CRC_ERROR"
+    if kind == 8:
+        return f"RESTART uptime={d}ms"
+    if kind == 9:
+        return f"DROPPED {d} records"
+    if kind == 10:
+        return f"LBT_AUTO floor={rssi} threshold {a - 256 if a > 127 else a} -> {b - 256 if b > 127 else b}"
+    return f"type={kind} a={a} len={length} rssi={rssi} snr={snr} b={b} d={d}"
+
+
+def decode(data, size):
+    boot = 0
+    for off in range(0, len(data), size):
+        magic, seq = struct.unpack_from('<II', data, off)
+        if magic != SECTOR_MAGIC:
+            continue
+        for pos in range(off + HDR_SIZE, off + size - RECORD.size + 1, RECORD.size):
+            ms, kind, a, length, rssi, snr, b, d = RECORD.unpack_from(data, pos)
+            if kind == 0xFF:
+                break
+            if kind == 1:
+                boot += 1
+            print(f"boot {boot:3d} {ms / 1000:12.3f}s  {describe(kind, a, length, rssi, snr, b, d)}")
+
+
+if args.file:
+    with open(args.file, 'rb') as f:
+        raw = f.read()
+    decode(raw, 4096)
+elif args.port:
+    raw, sector = read_dump()
+    if args.output:
+        with open(args.output, 'wb') as f:
+            f.write(raw)
+    decode(raw, sector)
+else:
+    parser.error("either --port or --file is required")